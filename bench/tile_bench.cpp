@@ -0,0 +1,116 @@
+/*
+ * tile_bench.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+// Times the interior sweep of a single block three ways:
+//   naive  the old loop nest, x outermost and z innermost, whatever the layout
+//   order  storage order (see tile.cpp), the whole interior as one tile
+//   tiled  storage order, in tile_shape() tiles
+// for a few sub-domain sizes, in both layouts. The counts have to agree.
+//
+// Build with `make SRC_DIRS=bench`, run with
+//   ./build/exec_bench [steps] [cache KB] [sizes...]
+
+#include "../v2/defs.h"
+#include "../v2/kernel.cpp"
+#include "../v2/tile.cpp"
+
+#include <random>
+
+static void sweep_naive(const Block<float> &data, Point lo, Point hi, int steps,
+                answer_t<float> &ans)
+{
+        for (int x = lo[0]; x < hi[0]; x++) for (int y = lo[1]; y < hi[1]; y++)
+                for (int z = lo[2]; z < hi[2]; z++) for (int t = 0; t < steps; t++) {
+                        float val = data(t, x, y, z);
+                        ans.gmin[t] = std::min(ans.gmin[t], val);
+                        ans.gmax[t] = std::max(ans.gmax[t], val);
+
+                        bool lmin = true, lmax = true;
+                        for (auto &o: STENCIL_7) {
+                                float v = data(t, x + o[0], y + o[1], z + o[2]);
+                                if (v > val - EPS) lmax = false;
+                                if (v < val + EPS) lmin = false;
+                        }
+
+                        ans.cnt_min[t] += static_cast<int>(lmin);
+                        ans.cnt_max[t] += static_cast<int>(lmax);
+                }
+}
+
+// seconds per sweep, best of a few runs of at least ~0.1 s each
+template<typename F>
+static double best(F sweep)
+{
+        double b = 1e30;
+        for (int k = 0; k < 3; k++) {
+                int reps = 0;
+                const double t0 = MPI_Wtime();
+                double t1 = t0;
+                while (t1 - t0 < 0.1) {
+                        sweep();
+                        reps++;
+                        t1 = MPI_Wtime();
+                }
+                b = std::min(b, (t1 - t0) / reps);
+        }
+        return b;
+}
+
+int main(int argc, char **argv)
+{
+        MPI_Init(&argc, &argv);
+
+        const int steps = argc > 1 ? atoi(argv[1]) : 7;
+        const long cache = argc > 2 && atol(argv[2]) > 0 ? atol(argv[2]) * 1024 : cache_size();
+        std::vector<int> sizes;
+        for (int i = 3; i < argc; i++) sizes.push_back(atoi(argv[i]));
+        if (sizes.empty()) sizes = { 32, 64, 128, 192 };
+
+        const row_kernel_t kernel = select_row_kernel("auto", 7, false);
+        std::mt19937 gen(333);
+        std::uniform_real_distribution<float> dist(0, 100);
+
+        printf("%d steps, tiles for %ld KB of cache\n", steps, cache / 1024);
+        printf("%-6s %-5s %-14s %10s %10s %10s %8s\n", "layout", "n", "tile",
+                        "naive ns", "order ns", "tiled ns", "speedup");
+
+        for (int n: sizes) for (Layout layout: { Layout::FILE_ORDER, Layout::TIME_MAJOR }) {
+                const Point bound { n, n, n };
+                Block<float> data(bound, steps, layout);
+                for (long i = 0; i < data.size(); i++) data.data[i] = dist(gen);
+
+                const Point lo { 1, 1, 1 }, hi { n - 1, n - 1, n - 1 };
+                const Point tile = tile_shape(bound, steps, cache);
+                const double points = static_cast<double>(!Point { n - 2, n - 2, n - 2 }) * steps;
+
+                answer_t<float> a(steps), b(steps), c(steps);
+                auto naive = [&]() { a = answer_t<float>(steps); sweep_naive(data, lo, hi, steps, a); };
+                auto order = [&]() { b = answer_t<float>(steps); sweep_tile(data, lo, hi, steps, 7, false, kernel, b); };
+                auto tiled = [&]() {
+                        c = answer_t<float>(steps);
+                        for (int z = 1; z < n - 1; z += tile[2]) for (int y = 1; y < n - 1; y += tile[1])
+                                for (int x = 1; x < n - 1; x += tile[0])
+                                        sweep_tile(data, Point { x, y, z }, Point { std::min(x + tile[0], n - 1),
+                                                        std::min(y + tile[1], n - 1), std::min(z + tile[2], n - 1) },
+                                                        steps, 7, false, kernel, c);
+                };
+
+                const double tn = best(naive), to = best(order), tt = best(tiled);
+                if (a.cnt_min != b.cnt_min || a.cnt_max != b.cnt_max || a.cnt_min != c.cnt_min
+                                || a.cnt_max != c.cnt_max)
+                        fprintf(stderr, "warning: counts differ for n = %d\n", n);
+
+                char shape[32];
+                snprintf(shape, sizeof(shape), "%dx%dx%d", tile[0], tile[1], tile[2]);
+                printf("%-6s %-5d %-14s %10.2f %10.2f %10.2f %7.2fx\n",
+                                layout == Layout::TIME_MAJOR ? "time" : "file", n, shape,
+                                tn / points * 1e9, to / points * 1e9, tt / points * 1e9, tn / tt);
+        }
+
+        MPI_Finalize();
+        return 0;
+}
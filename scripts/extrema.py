@@ -0,0 +1,39 @@
+import argparse
+import struct
+import sys
+
+# Prints what v2 --extrema=<file> wrote (see extrema_header_t in v2/defs.h):
+# a line per extremum, "x y z t value min|max|both", and the counts per
+# timestep on stderr, which should be the first line of the output file.
+
+MAGIC = b"PRLLZEXT"
+HEADER = struct.Struct("<8sIIiiiiiIQ")
+RECORD = struct.Struct("<iiiifI")
+KINDS = {1: "min", 2: "max", 3: "both"}
+
+
+def main():
+    p = argparse.ArgumentParser(description="python extrema.py file")
+    p.add_argument("file")
+    p.add_argument("-t", type=int, help="only this timestep")
+    args = p.parse_args()
+
+    with open(args.file, "rb") as f:
+        magic, version, flags, nx, ny, nz, nstep, stencil, _, count = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC or version != 1:
+            sys.exit(f"{args.file} isn't an extrema file")
+        print(f"# {nx} x {ny} x {nz} x {nstep}, {stencil}-point{' temporal' if flags & 1 else ''}, "
+              f"{count} extrema", file=sys.stderr)
+
+        cnt = [[0, 0] for _ in range(nstep)]
+        for x, y, z, t, value, kind in RECORD.iter_unpack(f.read(count * RECORD.size)):
+            cnt[t][0] += kind & 1
+            cnt[t][1] += kind >> 1
+            if args.t is None or args.t == t:
+                print(x, y, z, t, f"{value:g}", KINDS[kind])
+
+    print(" ".join(f"({a}, {b})" for a, b in cnt), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
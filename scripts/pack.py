@@ -0,0 +1,91 @@
+import argparse
+import struct
+import sys
+import zlib
+
+# Wraps a raw input (what gen_random.py writes) in the container v2 reads
+# (see file_header_t in v2/defs.h): a header with the dims and the type, an
+# index of chunks, each with its CRC-32, and then the chunks.
+#
+# Plain chunks are runs of whole z-planes, the values as they were starting
+# at a page boundary. With --deflate every chunk is a zlib stream of its own,
+# and a chunk is a box: --grid px py pz cuts them along the sub-domains of
+# that rank grid (and then in z, down to about --chunk MB each), so every rank
+# only reads and inflates its own.
+
+MAGIC = b"PRLLZ\0\0\0"
+VERSION = 2
+CRC = 1
+DEFLATE = 2
+TYPES = {"f32": (0, 4), "f64": (1, 8), "f16": (2, 2), "bf16": (3, 2)}
+HEADER = struct.Struct("<8sIIIIiiiiIIIIQ")
+CHUNK = struct.Struct("<QQII")
+ALIGN = 4096
+
+
+def main():
+    p = argparse.ArgumentParser(description="python pack.py raw out x y z m type")
+    p.add_argument("raw")
+    p.add_argument("out")
+    p.add_argument("dims", type=int, nargs=4, metavar="x y z m")
+    p.add_argument("type", choices=TYPES, help="what raw holds")
+    p.add_argument("--chunk", type=float, default=64, help="MB per chunk, about")
+    p.add_argument("--deflate", type=int, nargs="?", const=6, metavar="level")
+    p.add_argument("--grid", type=int, nargs=3, default=[1, 1, 1], metavar=("px", "py", "pz"))
+    args = p.parse_args()
+
+    x, y, z, m = args.dims
+    elem, size = TYPES[args.type]
+    point = m * size
+
+    # a sub-domain of the grid per chunk, as decompose() cuts them (but for
+    # the remainders, which get a chunk of their own), then split along z
+    ext = [x, y, z]
+    if args.deflate is not None:
+        ext = [max(1, n // g) for n, g in zip(ext, args.grid)]
+    ext[2] = max(1, min(ext[2], int(args.chunk * 2**20) // (ext[0] * ext[1] * point)))
+    count = [(n + e - 1) // e for n, e in zip((x, y, z), ext)]
+    chunks = count[0] * count[1] * count[2]
+
+    index = HEADER.size
+    data = (index + chunks * CHUNK.size + ALIGN - 1) // ALIGN * ALIGN
+    flags = CRC | (DEFLATE if args.deflate is not None else 0)
+
+    entries = []
+    plane = x * y * point
+    with open(args.raw, "rb") as src, open(args.out, "wb") as dst:
+        dst.write(b"\0" * data)
+        for cz in range(count[2]):
+            z0 = cz * ext[2]
+            n = min(ext[2], z - z0) * plane
+            planes = src.read(n)
+            if len(planes) != n:
+                sys.exit(f"{args.raw} is too short for {x} x {y} x {z} x {m} {args.type}")
+
+            for cy in range(count[1]):
+                for cx in range(count[0]):
+                    if args.deflate is None:
+                        buf = planes
+                    else:
+                        # the chunk's rows out of every plane, in file order
+                        x0, x1 = cx * ext[0], min(x, (cx + 1) * ext[0])
+                        y0, y1 = cy * ext[1], min(y, (cy + 1) * ext[1])
+                        rows = [planes[k * plane + (r * x + x0) * point:k * plane + (r * x + x1) * point]
+                                for k in range(n // plane) for r in range(y0, y1)]
+                        buf = zlib.compress(b"".join(rows), args.deflate)
+                    entries.append((dst.tell(), len(buf), zlib.crc32(buf), 0))
+                    dst.write(buf)
+
+        dst.seek(0)
+        dst.write(HEADER.pack(MAGIC, VERSION, elem, 0, flags, x, y, z, m, *ext, chunks, index))
+        for e in entries:
+            dst.write(CHUNK.pack(*e))
+
+    if args.deflate is not None:
+        raw = x * y * z * point
+        print(f"{chunks} chunks of {ext[0]} x {ext[1]} x {ext[2]}, "
+              f"{sum(e[1] for e in entries) / raw:.1%} of {raw} bytes")
+
+
+if __name__ == "__main__":
+    main()
@@ -29,6 +29,7 @@
 // config parameters
 
 const int MAX_MSG_SIZE = 1024 * 1024 * 4; // 4 MB 
+const int TEXT_CHUNK = 4096; // bytes read at a time to finish a rank's last line, see text.cpp
 
 #define MAGIC 333
 
@@ -189,8 +190,16 @@ typedef struct _config_t {
         
         const char* input_file;
         const char* output_file;
+        const char* binary_file; // where to write the parsed values raw, if anywhere
 } config_t;
 
+// rank_assgn[x][y][z] is the rank of the sub-domain at (x, y, z) of the grid
+using rank_grid_t = std::vector<std::vector<std::vector<int>>>;
+
+// reads the text input in parallel into every rank's block, see text.cpp
+void read_text(const config_t &config, Point bound, const rank_grid_t &rank_assgn,
+                Block<float> &data);
+
 template<typename T>
 struct answer_t {
         std::vector<int> cnt_min, cnt_max;
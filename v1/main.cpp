@@ -9,7 +9,7 @@
 
 int main(int argc, char **argv) {
         MPI_Init(&argc, &argv);
-        MPI_Errhandler_set(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
 
         double start_time = MPI_Wtime(); 
 
@@ -18,8 +18,10 @@ int main(int argc, char **argv) {
         MPI_Comm_size(MPI_COMM_WORLD, &mpi_sz);
 
         config_t config { }; 
-        if (argc != 10) {
+        if (argc < 10) {
                 fprintf(stderr, "Usage: 9 args are required.\n");
+                fprintf(stderr, "Options (after the 9 args): --binary=<file> to also write the "
+                                "values out raw, for v2\n");
                 return 0;
         }
 
@@ -32,6 +34,14 @@ int main(int argc, char **argv) {
         config.nz = atoi(argv[7]);
         config.nstep = atoi(argv[8]);
         config.output_file = argv[9];
+        for (int i = 10; i < argc; i++) {
+                if (!strncmp(argv[i], "--binary=", 9)) {
+                        config.binary_file = argv[i] + 9;
+                } else {
+                        fprintf(stderr, "Unknown option %s\n", argv[i]);
+                        return 0;
+                }
+        }
 
         assert(mpi_sz == config.px * config.py * config.pz);
         assert(config.nx % config.px == 0);
@@ -42,18 +52,9 @@ int main(int argc, char **argv) {
         Point bound { config.nx / config.px, config.ny / config.py,
                config.nz / config.pz }; 
 
-        auto is_corner {
-                [&bound, &config](int x, int y, int z) -> bool {
-                        int ret = x == (bound[0] - 1);
-                        ret &= y == (bound[1] - 1);
-                        ret &= z == (bound[2] - 1);
-                        return ret;
-                }
-        };
-
         Block<float> data(bound, config.nstep); // this rank's sub-domain
 
-        std::vector rank_assgn(config.px, std::vector(config.py, std::vector<int>(config.pz)));
+        rank_grid_t rank_assgn(config.px, std::vector(config.py, std::vector<int>(config.pz)));
         {
                 int rnk = 0;
                 for (int z = 0; z < config.pz; z++) for (int y = 0; y < config.py; y++)
@@ -66,55 +67,7 @@ int main(int argc, char **argv) {
         /*
          * Data I/O
          */
-        if (mpi_rank == 0) {
-                // sender
-                FILE *fptr = fopen(config.input_file, "r");
-                assert(fptr != NULL);
-
-                std::vector<Block<float>> data_to_send(mpi_sz, Block<float>(bound, config.nstep));
-
-                MPI_Request requests[mpi_sz];
-                for (int i = 0; i < mpi_sz; i++) requests[i] = MPI_REQUEST_NULL;
-                
-                for (int z = 0; z < config.nz; z++) for (int y = 0; y < config.ny; y++)
-                        for (int x = 0; x < config.nx; x++) {
-                                int _x = x % bound[0];
-                                int _y = y % bound[1];
-                                int _z = z % bound[2];
-
-                                int rnk = rank_assgn[x / bound[0]][y / bound[1]][z / bound[2]];
-                                for (int t = 0; t < config.nstep; t++) {
-                                        float val; [[maybe_unused]] int _tmp; 
-                                        _tmp = fscanf(fptr, "%f", &val);
-                                        passert(_tmp == 1);
-
-                                        if (rnk)
-                                                data_to_send[rnk](t, _x, _y, _z) = val;
-                                        else
-                                                data(t, _x, _y, _z) = val;
-                                }
-
-                                if (is_corner(_x, _y, _z)) {
-                                        if (rnk != 0) {
-                                                MPI_Wait(&requests[rnk], MPI_STATUS_IGNORE);
-                                                MPI_Isend(&data_to_send[rnk].data[0],
-                                                                data_to_send[rnk].block_sz * config.nstep,
-                                                                MPI_FLOAT,
-                                                                rnk,
-                                                                rnk,
-                                                                MPI_COMM_WORLD,
-                                                                &requests[rnk]);
-                                        } 
-                                }
-                        }
-
-                MPI_Waitall(mpi_sz - 1, &requests[1], MPI_STATUSES_IGNORE); 
-        } else {
-               // receive the data 
-               MPI_Recv(&data.data[0], data.block_sz * config.nstep,
-                               MPI_FLOAT, 0, mpi_rank, MPI_COMM_WORLD, 
-                               MPI_STATUS_IGNORE);
-        }
+        read_text(config, bound, rank_assgn, data);
 
         // convention: x -1, y -1, z -1, x +1, y +1, z +1
         std::vector<int> neighbours(6, MPI_PROC_NULL);
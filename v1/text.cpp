@@ -0,0 +1,153 @@
+/*
+ * text.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+#include <charconv>
+
+// Every rank reads an equal byte range of the file and parses the lines that
+// start in it (the one it ends in is read on to its newline). The values come
+// out in file order, so an exclusive scan over the counts says where each
+// rank's run starts in the volume, and from that where every value has to go.
+// Sorted by destination they stay in file order, and the sources are too, so
+// what a rank receives in rank order is its sub-domain in Block order: one
+// MPI_Alltoallv straight into data.
+void read_text(const config_t &config, Point bound, const rank_grid_t &rank_assgn,
+                Block<float> &data)
+{
+        int mpi_rank, mpi_sz;
+        MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &mpi_sz);
+
+        MPI_File fh;
+        if (MPI_File_open(MPI_COMM_WORLD, config.input_file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh)
+                        != MPI_SUCCESS) {
+                if (mpi_rank == 0) fprintf(stderr, "can't open %s\n", config.input_file);
+                MPI_Barrier(MPI_COMM_WORLD);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_Offset file_sz;
+        MPI_File_get_size(fh, &file_sz);
+
+        // [lo, hi) is ours, and the byte before it says whether a line starts at lo
+        const MPI_Offset lo = file_sz * mpi_rank / mpi_sz, hi = file_sz * (mpi_rank + 1) / mpi_sz;
+        const MPI_Offset from = std::max<MPI_Offset>(lo - 1, 0);
+        std::vector<char> text(hi - from);
+        MPI_File_read_at_all(fh, from, text.data(), text.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+        // the last line that starts in range ends at the first newline from hi - 1
+        auto newline = [&text, from](MPI_Offset at) -> MPI_Offset {
+                at = std::max(at, from);
+                const void *p = memchr(text.data() + (at - from), '\n', text.size() - (at - from));
+                return p ? static_cast<const char*>(p) - text.data() + from : -1;
+        };
+        MPI_Offset end = newline(hi - 1);
+        while (end < 0 && from + static_cast<MPI_Offset>(text.size()) < file_sz) {
+                const MPI_Offset at = from + text.size();
+                const int n = std::min<MPI_Offset>(TEXT_CHUNK, file_sz - at);
+                text.resize(text.size() + n);
+                MPI_File_read_at(fh, at, text.data() + text.size() - n, n, MPI_CHAR,
+                                MPI_STATUS_IGNORE);
+                end = newline(at);
+        }
+        if (end < 0) end = from + text.size();
+        MPI_File_close(&fh);
+
+        // the first line that starts in range
+        MPI_Offset start = lo;
+        if (lo > 0) {
+                start = newline(lo - 1);
+                start = start < 0 ? end : start + 1;
+        }
+
+        // none, if the line that starts in range goes on past it
+        if (start >= hi) end = start;
+
+        std::vector<float> vals;
+        const char *p = text.data() + (start - from), *last = text.data() + (end - from);
+        while (p < last) {
+                while (p < last && isspace(static_cast<unsigned char>(*p))) p++;
+                if (p == last) break;
+
+                float v;
+                auto [next, err] = std::from_chars(p, last, v);
+                if (err != std::errc()) {
+                        fprintf(stderr, "%s: can't parse a value at byte %lld\n", config.input_file,
+                                        static_cast<long long>(p - text.data() + from));
+                        MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                vals.push_back(v);
+                p = next;
+        }
+        text = std::vector<char>();
+
+        long count = vals.size(), first = 0, total = 0;
+        MPI_Exscan(&count, &first, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+        if (mpi_rank == 0) first = 0;
+        MPI_Allreduce(&count, &total, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+        const long want = static_cast<long>(config.nx) * config.ny * config.nz * config.nstep;
+        // anything but the volume's worth and the blocks would be off. rank 0
+        // says so before everybody goes
+        if (total != want) {
+                if (mpi_rank == 0)
+                        fprintf(stderr, "%s has %ld values, not %ld\n", config.input_file,
+                                        total, want);
+                MPI_Barrier(MPI_COMM_WORLD);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        // our values in runs along x, each up to where the next sub-domain
+        // (or our values) starts
+        const long nstep = config.nstep;
+        std::vector<int> send_cnt(mpi_sz, 0), send_at(mpi_sz, 0);
+        std::vector<std::pair<int, long>> runs; // destination, values
+        for (long g = first; g < first + count; ) {
+                const long pt = g / nstep, row = pt / config.nx;
+                const int x = pt % config.nx, y = row % config.ny, z = row / config.ny;
+                const int xe = std::min(config.nx, (x / bound[0] + 1) * bound[0]);
+                const long ge = std::min((row * config.nx + xe) * nstep, first + count);
+
+                const int dst = rank_assgn[x / bound[0]][y / bound[1]][z / bound[2]];
+                runs.push_back({ dst, ge - g });
+                send_cnt[dst] += ge - g;
+                g = ge;
+        }
+        for (int r = 1; r < mpi_sz; r++) send_at[r] = send_at[r - 1] + send_cnt[r - 1];
+
+        std::vector<float> out(count);
+        {
+                std::vector<int> at = send_at;
+                long k = 0;
+                for (auto [dst, n]: runs) {
+                        std::copy(vals.begin() + k, vals.begin() + k + n, out.begin() + at[dst]);
+                        at[dst] += n;
+                        k += n;
+                }
+        }
+
+        std::vector<int> recv_cnt(mpi_sz), recv_at(mpi_sz, 0);
+        MPI_Alltoall(send_cnt.data(), 1, MPI_INT, recv_cnt.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        for (int r = 1; r < mpi_sz; r++) recv_at[r] = recv_at[r - 1] + recv_cnt[r - 1];
+
+        MPI_Alltoallv(out.data(), send_cnt.data(), send_at.data(), MPI_FLOAT, data.data.data(),
+                        recv_cnt.data(), recv_at.data(), MPI_FLOAT, MPI_COMM_WORLD);
+
+        // the raw floats (what v2 reads), every rank's run at its place
+        if (config.binary_file) {
+                MPI_File out_fh;
+                if (MPI_File_open(MPI_COMM_WORLD, config.binary_file,
+                                        MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &out_fh)
+                                != MPI_SUCCESS) {
+                        if (mpi_rank == 0) fprintf(stderr, "can't open %s\n", config.binary_file);
+                        return;
+                }
+                MPI_File_set_size(out_fh, total * sizeof(float));
+                MPI_File_write_at_all(out_fh, first * sizeof(float), vals.data(), count, MPI_FLOAT,
+                                MPI_STATUS_IGNORE);
+                MPI_File_close(&out_fh);
+        }
+}
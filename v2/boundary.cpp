@@ -0,0 +1,138 @@
+/*
+ * boundary.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+#include <utility>
+
+std::vector<Region> shell_regions(Point bound)
+{
+        // the spans each axis splits into
+        std::array<std::vector<int>, 3> spans;
+        for (int i = 0; i < 3; i++) {
+                if (bound[i] == 1) {
+                        spans[i] = { BOTH };
+                } else {
+                        spans[i] = { LO, HI };
+                        if (bound[i] > 2) spans[i].push_back(MID);
+                }
+        }
+
+        std::vector<Region> regions;
+        for (int sx: spans[0]) for (int sy: spans[1]) for (int sz: spans[2]) {
+                if (sx == MID && sy == MID && sz == MID) continue; // the interior
+                regions.push_back(Region { { sx, sy, sz } });
+        }
+        return regions;
+}
+
+// neighbour O of (x, y, z), from the halo the region says it's on if it's off
+// the block
+template<int O, int SX, int SY, int SZ, typename T>
+__attribute__((always_inline)) static inline T neighbour(const Block<T> &data, const Halo<T> &halo,
+                int t, int x, int y, int z)
+{
+        constexpr auto o = DIRECTIONS[O];
+        constexpr int h = Region { { SX, SY, SZ } }.halo(o);
+
+        if constexpr (h >= 0)
+                return halo.template at<h>(t, x + o[0], y + o[1], z + o[2]);
+        else
+                return data(t, x + o[0], y + o[1], z + o[2]);
+}
+
+template<typename T, int N, int SX, int SY, int SZ, std::size_t... O>
+__attribute__((always_inline)) static inline void neighbours(const Block<T> &data,
+                const Halo<T> &halo, int t, int x, int y, int z, T *v, std::index_sequence<O...>)
+{
+        ((v[O] = neighbour<O, SX, SY, SZ>(data, halo, t, x, y, z)), ...);
+}
+
+template<typename T, int N, int SX, int SY, int SZ>
+static void sweep(Block<T> &data, Halo<T> &halo, Point bound, int steps, bool temporal,
+                answer_t<T> &ans)
+{
+        const int span[3] = { SX, SY, SZ };
+        int lo[3], hi[3];
+        for (int i = 0; i < 3; i++) {
+                lo[i] = span[i] == HI ? bound[i] - 1 : span[i] == MID ? 1 : 0;
+                hi[i] = span[i] == MID ? bound[i] - 1 : lo[i] + 1;
+        }
+
+        // where each neighbour comes from is fixed for the whole region.
+        // missing neighbours have NaN halos (see Halo), which fail both
+        // comparisons and so drop out without a branch here
+        auto point = [&](int t, int x, int y, int z) __attribute__((always_inline)) {
+                T val = data(t, x, y, z);
+                ans.gmin[t] = std::min(ans.gmin[t], val);
+                ans.gmax[t] = std::max(ans.gmax[t], val);
+
+                T v[N - 1];
+                neighbours<T, N, SX, SY, SZ>(data, halo, t, x, y, z, v,
+                                std::make_index_sequence<N - 1>());
+
+                bool lmin = true, lmax = true;
+                for (int i = 0; i < N - 1; i++) {
+                        if (v[i] > val - EPS) lmax = false;
+                        if (v[i] < val + EPS) lmin = false;
+                }
+
+                // the point itself a timestep either side, where there is one
+                if (temporal)
+                        for (int u = t - 1; u <= t + 1; u += 2) {
+                                if (u < 0 || u >= steps) continue;
+                                const T w = data(u, x, y, z);
+                                if (w > val - EPS) lmax = false;
+                                if (w < val + EPS) lmin = false;
+                        }
+
+                ans.cnt_min[t] += static_cast<int>(lmin);
+                ans.cnt_max[t] += static_cast<int>(lmax);
+                if (ans.locate && (lmin || lmax))
+                        ans.extrema.push_back(extremum_t { x, y, z, t, static_cast<float>(val),
+                                        lmin * EXTREMUM_MIN | lmax * EXTREMUM_MAX });
+        };
+
+        // walk in storage order
+        if (data.get_layout() == Layout::TIME_MAJOR) {
+                for (int t = 0; t < steps; t++)
+                        for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++)
+                                for (int x = lo[0]; x < hi[0]; x++)
+                                        point(t, x, y, z);
+        } else {
+                for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++)
+                        for (int x = lo[0]; x < hi[0]; x++) for (int t = 0; t < steps; t++)
+                                point(t, x, y, z);
+        }
+}
+
+template<typename T>
+using sweep_fn = void (*)(Block<T>&, Halo<T>&, Point, int, bool, answer_t<T>&);
+
+// one instantiation per (SX, SY, SZ), indexed by SX + 4 * SY + 16 * SZ
+template<typename T, int N, std::size_t... I>
+static constexpr std::array<sweep_fn<T>, sizeof...(I)> sweep_table(std::index_sequence<I...>)
+{
+        return { &sweep<T, N, I % 4, I / 4 % 4, I / 16>... };
+}
+
+template<typename T>
+void sweep_region(const Region &r, Block<T> &data, Halo<T> &halo, Point bound,
+                int steps, int n, bool temporal, answer_t<T> &ans)
+{
+        static constexpr auto table_7 { sweep_table<T, 7>(std::make_index_sequence<64>()) };
+        static constexpr auto table_19 { sweep_table<T, 19>(std::make_index_sequence<64>()) };
+        static constexpr auto table_27 { sweep_table<T, 27>(std::make_index_sequence<64>()) };
+
+        const auto &table = n == 27 ? table_27 : n == 19 ? table_19 : table_7;
+        table[r.span[0] + 4 * r.span[1] + 16 * r.span[2]](data, halo, bound, steps, temporal, ans);
+}
+
+template void sweep_region<float>(const Region&, Block<float>&, Halo<float>&, Point, int, int,
+                bool, answer_t<float>&);
+template void sweep_region<double>(const Region&, Block<double>&, Halo<double>&, Point, int, int,
+                bool, answer_t<double>&);
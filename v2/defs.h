@@ -14,12 +14,26 @@
 #include <cmath>
 #include <vector>
 #include <limits>
+#include <map>
 #include <memory>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "mpi.h"
 
 // comment this for timing runs
@@ -28,10 +42,14 @@
 
 // config parameters
 
-const int VALUE_SZ = 4; // set 8 for float, 4 for bytes
-const int MAX_CHUNK_SZ = 20 * 1024 * 1024; // 20 MB
+const long MEM_BUDGET = 1024L * 1024 * 1024; // per rank, for the chunk buffers; see plan.cpp
+const long L2_SIZE = 1024L * 1024; // bytes, if the OS won't tell; see tile.cpp
+const long SAMPLE_SZ = 32L * 1024 * 1024; // bytes read per candidate when tuning the I/O, see io.cpp
+#define IO_CACHE ".prllz_io" // where tuned I/O settings are kept, unless $PRLLZ_IO_CACHE says
+const int TILE_DEPTH = 16; // interior tile depth in planes, also what's swept between halo polls
 
 #define MAGIC 333
+#define MAGIC_DONE 777 // "done reading your block", see Halo
 
 #define EPS 0.0001
 
@@ -78,6 +96,110 @@ struct _Point {
 
 using Point = struct _Point<int>;
 
+/*
+ * How the values are stored in the input file (--type):
+ *   F32  float, what it's always been
+ *   F64  double, computed on as doubles throughout
+ *   F16  IEEE half, widened to float on the way into a block
+ *   BF16 bfloat16 (a float's top 16 bits), widened the same way
+ * The 16-bit ones halve the file and whatever is read out of it before the
+ * widening, the blocks themselves are float.
+ */
+enum class Elem { F32, F64, F16, BF16 };
+
+struct half_t {
+        uint16_t bits;
+
+        // the bits moved into float position: a normal or subnormal half is
+        // then off by a factor 2^112, which the multiply puts right. inf and
+        // NaN just need the exponent filled in
+        operator float() const {
+                const uint32_t em = bits & 0x7fff;
+                const uint32_t u = em >= 0x7c00 ? em << 13 | 0x7f800000 : em << 13;
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                if (em < 0x7c00) f *= 0x1p112f;
+                return bits & 0x8000 ? -f : f;
+        }
+};
+
+struct bfloat16_t {
+        uint16_t bits;
+
+        operator float() const {
+                const uint32_t u = static_cast<uint32_t>(bits) << 16;
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                return f;
+        }
+};
+
+// What an element type is to MPI, and what it's computed in
+template<typename S> struct elem_traits;
+template<> struct elem_traits<float> {
+        using compute = float;
+        static MPI_Datatype mpi() { return MPI_FLOAT; }
+};
+template<> struct elem_traits<double> {
+        using compute = double;
+        static MPI_Datatype mpi() { return MPI_DOUBLE; }
+};
+template<> struct elem_traits<half_t> {
+        using compute = float;
+        static MPI_Datatype mpi() { return MPI_UINT16_T; }
+};
+template<> struct elem_traits<bfloat16_t> {
+        using compute = float;
+        static MPI_Datatype mpi() { return MPI_UINT16_T; }
+};
+
+inline int elem_size(Elem e) { return e == Elem::F64 ? 8 : e == Elem::F32 ? 4 : 2; }
+inline MPI_Datatype elem_mpi(Elem e) {
+        return e == Elem::F64 ? MPI_DOUBLE : e == Elem::F32 ? MPI_FLOAT : MPI_UINT16_T;
+}
+
+// The 7-point stencil, as offsets of the face neighbours. The order is the halo
+// convention (x -1, y -1, z -1, x +1, y +1, z +1), so neighbour i of a point
+// on face i of a block comes from halo plane i.
+constexpr std::array<std::array<int, 3>, 6> STENCIL_7 {{
+        { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 },
+        { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }
+}};
+
+// Every direction a neighbour can be in: the 6 faces first, as in STENCIL_7,
+// then the 12 edges and the 8 corners. The N-point stencils (N = 7, 19 or 27)
+// are the first N - 1 of them, and the halos are numbered the same way.
+constexpr int DIRS = 26;
+constexpr std::array<std::array<int, 3>, DIRS> DIRECTIONS = [] {
+        std::array<std::array<int, 3>, DIRS> d { };
+        int n = 0;
+        for (auto &o: STENCIL_7) d[n++] = o;
+        for (int k = 2; k <= 3; k++)
+                for (int z = -1; z <= 1; z++) for (int y = -1; y <= 1; y++)
+                        for (int x = -1; x <= 1; x++)
+                                if (x * x + y * y + z * z == k) d[n++] = { x, y, z };
+        return d;
+}();
+
+// the index of (x, y, z) in DIRECTIONS, -1 for (0, 0, 0)
+constexpr int direction(int x, int y, int z)
+{
+        for (int i = 0; i < DIRS; i++)
+                if (DIRECTIONS[i][0] == x && DIRECTIONS[i][1] == y && DIRECTIONS[i][2] == z)
+                        return i;
+        return -1;
+}
+
+inline bool valid_stencil(int n) { return n == 7 || n == 19 || n == 27; }
+
+/*
+ * Memory layout of a Block.
+ *   FILE_ORDER: [z][y][x][t], i.e. exactly how the input file stores it
+ *   TIME_MAJOR: [t][z][y][x], every timestep is a contiguous volume so the
+ *               stencil runs unit-stride along x and can use the full SIMD width
+ */
+enum class Layout { FILE_ORDER, TIME_MAJOR };
+
 /*
  * A "block" of data. Represented by two corner points - the lower one is (0, 0, 0),
  * and the higher one is "bound".
@@ -87,28 +209,224 @@ class Block final {
 private:
         Point bound;
         int steps; // no. of time steps
+        Layout layout;
+        std::vector<T> own; // the storage, unless the block was handed some
+        std::shared_ptr<void> mapping; // unmaps the file a mapped block reads from
+
+        template<typename> friend class Block; // the copies convert
+
+        void set_strides() {
+                if (layout == Layout::TIME_MAJOR) {
+                        sx = 1;
+                        sy = bound[0];
+                        sz = static_cast<long>(bound[0]) * bound[1];
+                        st = sz * bound[2];
+                } else {
+                        st = 1;
+                        sx = steps;
+                        sy = static_cast<long>(bound[0]) * steps;
+                        sz = sy * bound[1];
+                }
+        }
 public:
+        // element strides along t, x, y, z
+        long st, sx, sy, sz;
+
         const int block_sz;
-        std::vector<T> data;
+        T *data;
 
-        Block(Point _bound, int _steps) : bound { _bound },
+        // storage, if given, has to hold size() elements and outlive the block
+        Block(Point _bound, int _steps, Layout _layout = Layout::FILE_ORDER,
+                        T *storage = nullptr) : bound { _bound },
                 steps { _steps },
+                layout { _layout },
+                own ( storage ? 0 : (!_bound) * _steps , T { }),
                 block_sz { !_bound },
-                data ( (!_bound) * _steps , 0)
+                data { storage ? storage : own.data() }
         {
+                set_strides();
+        }
+
+        // data points into own, so no copies. moving keeps own's buffer in place
+        Block(const Block&) = delete;
+        Block(Block&&) = default;
+
+        // The file at path as a read-only block in file layout, mapped rather
+        // than read: the page cache is the storage, shared by every rank on the
+        // node. huge asks for huge pages, which only some file systems give.
+        // The values start offset bytes into the file.
+        // Returns an empty block (data == nullptr) if the file can't be mapped.
+        static Block<T> map(const char *path, Point bound, int steps, bool huge, size_t offset = 0) {
+                const size_t len = offset
+                        + static_cast<size_t>(bound[0]) * bound[1] * bound[2] * steps * sizeof(T);
+                void *addr = MAP_FAILED;
+                const int fd = open(path, O_RDONLY);
+                if (fd >= 0) {
+                        struct stat st;
+                        if (!fstat(fd, &st) && static_cast<size_t>(st.st_size) >= len)
+                                addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+                        close(fd);
+                }
+                if (addr == MAP_FAILED) {
+                        Block<T> none(Point { 0, 0, 0 }, steps);
+                        none.data = nullptr;
+                        return none;
+                }
+
+                // ranks read their own rows, in order, a window at a time
+                madvise(addr, len, MADV_SEQUENTIAL);
+                if (huge) madvise(addr, len, MADV_HUGEPAGE);
+
+                Block<T> b(bound, steps, Layout::FILE_ORDER,
+                                reinterpret_cast<T*>(static_cast<char*>(addr) + offset));
+                b.mapping = std::shared_ptr<void>(addr, [len](void *a) { munmap(a, len); });
+                return b;
+        }
+
+        // passes advice (MADV_*) on the pages under the box [lo, lo + n) of a
+        // mapped block to the kernel
+        void advise(Point lo, Point n, int advice) const {
+                if (!mapping || !n == 0) return;
+
+                const long page = sysconf(_SC_PAGESIZE);
+                auto range = [&](const T *from, const T *to) {
+                        const uintptr_t a = reinterpret_cast<uintptr_t>(from) & ~(page - 1);
+                        madvise(reinterpret_cast<void*>(a), reinterpret_cast<uintptr_t>(to) - a, advice);
+                };
+
+                // the rows of a plane are close enough to take in one go
+                for (int z = lo[2]; z < lo[2] + n[2]; z++)
+                        range(&data[lo[0] * sx + lo[1] * sy + z * sz],
+                                        &data[(lo[0] + n[0]) * sx + (lo[1] + n[1] - 1) * sy + z * sz]);
         }
 
+        Layout get_layout() const { return layout; }
+        Point get_bound() const { return bound; }
+        long size() const { return static_cast<long>(block_sz) * steps; }
+
         // Note: the operator is (x, y, z) unlike your usual array subscripting [z][y][x]
         __attribute__((always_inline)) T& operator() (int t, int x, int y, int z) {
                 passert(x < bound[0] && y < bound[1] && z < bound[2]);
-                return data[z * bound[0] * bound[1] * steps
-                        + y * bound[0] * steps + x * steps + t];
+                return data[t * st + x * sx + y * sy + z * sz];
         }
 
         __attribute__((always_inline)) T operator() (int t, int x, int y, int z) const {
                 passert(x < bound[0] && y < bound[1] && z < bound[2]);
-                return data[z * bound[0] * bound[1] * steps
-                        + y * bound[0] * steps + x * steps + t];
+                return data[t * st + x * sx + y * sy + z * sz];
+        }
+
+        // fills this block from one of the same shape, converting the layout
+        void copy_from(const Block<T> &src) {
+                passert(src.bound[2] == bound[2]);
+
+                if (src.layout == layout) {
+                        std::copy(src.data, src.data + size(), data);
+                        return;
+                }
+                copy_planes(src, 2, 0, 0, bound[2]);
+        }
+
+        // Copies the planes [from, from + depth) across axis (1 for y, 2 for z) of
+        // src to [to, to + depth) of this block, converting the layout (and the
+        // values, if src holds another type). The blocks only have to agree on
+        // the other two axes; src may be this block if to <= from.
+        template<typename S>
+        void copy_planes(const Block<S> &src, int axis, int from, int to, int depth) {
+                passert(axis == 1 || axis == 2);
+                passert(src.steps == steps);
+
+                if (src.layout == layout) {
+                        // a run of planes is contiguous per timestep in time-major,
+                        // and per z for y-planes. copying forwards is fine for to <= from
+                        const long ss = axis == 2 ? src.sz : src.sy, ds = axis == 2 ? sz : sy;
+                        const int nt = layout == Layout::TIME_MAJOR ? steps : 1;
+                        const int nz = axis == 1 ? bound[2] : 1;
+                        for (int t = 0; t < nt; t++) for (int z = 0; z < nz; z++) {
+                                const S *s = src.data + t * src.st + z * src.sz + from * ss;
+                                std::copy(s, s + depth * ss, data + t * st + z * sz + to * ds);
+                        }
+                        return;
+                }
+
+                Point n = bound, os { 0, 0, 0 }, od { 0, 0, 0 };
+                n[axis] = depth;
+                os[axis] = from;
+                od[axis] = to;
+
+                // walk the destination sequentially, the source strides are small
+                // either way (steps in one direction, a row in the other)
+                if (layout == Layout::TIME_MAJOR) {
+                        for (int t = 0; t < steps; t++) for (int z = 0; z < n[2]; z++)
+                                for (int y = 0; y < n[1]; y++) for (int x = 0; x < n[0]; x++)
+                                        (*this)(t, od[0] + x, od[1] + y, od[2] + z) =
+                                                src(t, os[0] + x, os[1] + y, os[2] + z);
+                } else {
+                        for (int z = 0; z < n[2]; z++) for (int y = 0; y < n[1]; y++)
+                                for (int x = 0; x < n[0]; x++) for (int t = 0; t < steps; t++)
+                                        (*this)(t, od[0] + x, od[1] + y, od[2] + z) =
+                                                src(t, os[0] + x, os[1] + y, os[2] + z);
+                }
+        }
+
+        // Copies the box [from, from + n) of src to [to, to + n) of this block,
+        // converting the layout and values. Unlike copy_planes the blocks don't
+        // have to agree on anything, src may be a whole mapped volume.
+        template<typename S>
+        void copy_box(const Block<S> &src, Point from, Point to, Point n) {
+                passert(src.steps == steps);
+
+                if (layout == Layout::TIME_MAJOR) {
+                        for (int t = 0; t < steps; t++) for (int z = 0; z < n[2]; z++)
+                                for (int y = 0; y < n[1]; y++) for (int x = 0; x < n[0]; x++)
+                                        (*this)(t, to[0] + x, to[1] + y, to[2] + z) =
+                                                src(t, from[0] + x, from[1] + y, from[2] + z);
+                        return;
+                }
+
+                for (int z = 0; z < n[2]; z++) for (int y = 0; y < n[1]; y++) {
+                        if (src.layout == layout) {
+                                // a row of points is a run of n[0] * steps values
+                                const S *s = &src.data[from[0] * src.sx + (from[1] + y) * src.sy
+                                        + (from[2] + z) * src.sz];
+                                std::copy(s, s + n[0] * steps, &(*this)(0, to[0], to[1] + y, to[2] + z));
+                                continue;
+                        }
+                        for (int x = 0; x < n[0]; x++) for (int t = 0; t < steps; t++)
+                                (*this)(t, to[0] + x, to[1] + y, to[2] + z) =
+                                        src(t, from[0] + x, from[1] + y, from[2] + z);
+                }
+        }
+
+        // sets every point of the planes [from, from + depth) across axis to val
+        void fill_planes(int axis, int from, int depth, T val) {
+                const long s = axis == 2 ? sz : sy;
+                const int nt = layout == Layout::TIME_MAJOR ? steps : 1;
+                const int nz = axis == 1 ? bound[2] : 1;
+                for (int t = 0; t < nt; t++) for (int z = 0; z < nz; z++) {
+                        T *d = data + t * st + z * sz + from * s;
+                        std::fill(d, d + depth * s, val);
+                }
+        }
+
+        // An (uncommitted) MPI datatype selecting all timesteps of the sub-block
+        // [lo, lo + sub), relative to &data[0]. Works for either layout, which is
+        // what lets the halo planes follow the layout around.
+        MPI_Datatype subarray(Point lo, Point sub, MPI_Datatype elem) const {
+                MPI_Datatype type;
+                if (layout == Layout::TIME_MAJOR) {
+                        int sizes[4] = { steps, bound[2], bound[1], bound[0] };
+                        int subsizes[4] = { steps, sub[2], sub[1], sub[0] };
+                        int starts[4] = { 0, lo[2], lo[1], lo[0] };
+                        MPI_Type_create_subarray(4, sizes, subsizes, starts,
+                                        MPI_ORDER_C, elem, &type);
+                } else {
+                        int sizes[4] = { bound[2], bound[1], bound[0], steps };
+                        int subsizes[4] = { sub[2], sub[1], sub[0], steps };
+                        int starts[4] = { lo[2], lo[1], lo[0], 0 };
+                        MPI_Type_create_subarray(4, sizes, subsizes, starts,
+                                        MPI_ORDER_C, elem, &type);
+                }
+                return type;
         }
 };
 
@@ -120,10 +438,10 @@ public:
         Block<T> block { };
         const int block_sz;
 
-        Block2D(int _x, int _y, int _steps) : sx { _x },
+        Block2D(int _x, int _y, int _steps, Layout _layout) : sx { _x },
                 sy { _y },
                 steps { _steps },
-                block { Point { _x, _y, 1}, _steps },
+                block { Point { _x, _y, 1}, _steps, _layout },
                 block_sz { _x * _y }
         {
         }
@@ -137,73 +455,220 @@ public:
         }
 };
 
+/*
+ * A window shared by the ranks of a node, each of which keeps its block in its
+ * own segment of it. Halo reads the faces of on-node neighbours straight out
+ * of there. A segment starts with a header saying how the block in it is laid
+ * out, which its owner keeps up to date.
+ */
+struct node_t {
+        MPI_Comm comm = MPI_COMM_NULL; // the ranks on this node
+        MPI_Win win = MPI_WIN_NULL;
+        void *segment = nullptr; // this rank's
+
+        struct header_t {
+                long st, sx, sy, sz;
+                int bound[3];
+        };
+        static constexpr long HEADER = 64; // bytes, keeps the block cache-line aligned
+
+        template<typename T>
+        T *storage() const { return reinterpret_cast<T*>(static_cast<char*>(segment) + HEADER); }
+};
+
+// One halo, wherever it lives: a plane (face), a line (edge) or a single
+// point (corner) of a block. It's indexed with the coordinates of the points
+// off our block it stands for; the strides along the axes it's only one deep
+// in are 0, so whatever those coordinates are doesn't matter.
+template<typename T>
+struct plane_t {
+        const T *base;
+        long st, sx, sy, sz;
+
+        __attribute__((always_inline)) T operator() (int t, int x, int y, int z) const {
+                return base[t * st + x * sx + y * sy + z * sz];
+        }
+};
+
 template<typename T>
 class Halo final {
 private:
         Block<T> &data;
         
-        MPI_Datatype halo_xy, halo_yz, halo_zx;
+        MPI_Datatype types[DIRS]; // what we send each way, as subarrays of data
 
         std::vector<int> neighbours;
         Point bound;
         int steps;
-        MPI_Request requests[6];
+        MPI_Request requests[DIRS], sends[DIRS]; // persistent
+        MPI_Comm comm;
         int my_rank;
+
+        // on-node neighbours, whose planes are read in place
+        const node_t *node;
+        int shared = 0;           // as bits, in direction order
+        const void *peers[DIRS];  // their segments
+        MPI_Request done_recvs[DIRS], done_sends[DIRS];
+
+        void attach(int i);
+        void arrive(int i);
 public:
         // does making halo_recv public make it easier for the compiler to inline
         // the operators?
         // idts but yeah who knows
         std::vector<Block2D<T>> halo_recv;
 
-        Halo(Block<T> _data, std::vector<int> _neighbours,
-                        int _rank, Point _bound, int _steps); 
-
-        void recv();
-        void wait();
+        // where at() finds halo i: halo_recv[i] or a neighbour's block
+        plane_t<T> planes[DIRS];
+
+        // neighbours has a rank per direction (see DIRECTIONS), or
+        // MPI_PROC_NULL. Only the halos an n-point stencil reads are exchanged:
+        // the faces, then the edges for 19 and the corners for 27.
+        // With a node, data has to live in node's segment (node->storage()), and
+        // the neighbours on the same node swap zero-byte messages instead of
+        // planes: "ready" once a block is filled, "done" once the neighbours are
+        // through reading it.
+        Halo(Block<T> &_data, std::vector<int> _neighbours, MPI_Comm _comm,
+                        int _rank, Point _bound, int _steps, int n,
+                        const node_t *_node = nullptr); 
+
+        // bit i is set once halo i is usable: received, or no neighbour there
+        int arrived;
+
+        // starts one exchange of the block's current contents
+        void start();
+        // non-blocking, picks up whatever has arrived since the last call
+        int poll();
+        // blocks until one more halo arrives (returns right away if all have)
+        int wait_any();
+        // completes the exchange, after which the block may be overwritten
+        void finish();
         void free(); 
 
-        __attribute__((always_inline)) T& operator() (int t, int x, int y, int z) {
-                if (x < 0) {
-                        return halo_recv[0](t, y, z);
-                } else if (y < 0) {
-                        return halo_recv[1](t, x, z);
-                } else if (z < 0) {
-                        return halo_recv[2](t, x, y);
-                } else if (x == bound[0]) {
-                        return halo_recv[3](t, y, z);
-                } else if (y == bound[1]) {
-                        return halo_recv[4](t, x, z);
-                } 
-                passert(z == bound[2]);
-                return halo_recv[5](t, x, y);
-        }
-
-        // instead of going through the headache of redefining the operator for const
-        // objects, we can simply delete it since const Halo objects shouldn't exist
-        T operator() (int t, int x, int y, int z) const = delete;
+        // the point (x, y, z) off the block in direction D, which must be on halo D
+        template<int D>
+        __attribute__((always_inline)) T at(int t, int x, int y, int z) const {
+                return planes[D](t, x, y, z);
+        }
 };
 
+/*
+ * The shell of a block (every point with at least one neighbour off the block)
+ * split by where the neighbours come from. Along each axis a region spans
+ *   LO   the first plane, whose -1 neighbour is on a halo plane
+ *   MID  the planes 1 .. n-2, all neighbours inside the block
+ *   HI   the last plane, whose +1 neighbour is on a halo plane
+ *   BOTH the single plane of an axis with n == 1, both neighbours on halos
+ * That gives the 6 faces, 12 edges and 8 corners (fewer for thin blocks),
+ * each of which is swept by its own specialised loop in boundary.cpp.
+ */
+enum Span { LO, MID, HI, BOTH };
+
+struct Region {
+        int span[3];
+
+        // whether the neighbour d (-1, 0 or 1) along axis a is off the block
+        constexpr bool leaves(int a, int d) const {
+                return (d < 0 && (span[a] == LO || span[a] == BOTH))
+                        || (d > 0 && (span[a] == HI || span[a] == BOTH));
+        }
+
+        // the direction of the halo neighbour o of the region's points is on,
+        // -1 if it's on the block
+        constexpr int halo(const std::array<int, 3> &o) const {
+                return direction(leaves(0, o[0]) ? o[0] : 0, leaves(1, o[1]) ? o[1] : 0,
+                                leaves(2, o[2]) ? o[2] : 0);
+        }
+
+        // the halos (as bits, in direction order) this region reads from with
+        // an n-point stencil
+        int halos(int n) const {
+                int mask = 0;
+                for (int i = 0; i < n - 1; i++)
+                        if (halo(DIRECTIONS[i]) >= 0) mask |= 1 << halo(DIRECTIONS[i]);
+                return mask;
+        }
+};
+
+std::vector<Region> shell_regions(Point bound);
+
+// partial results of sweeping a run of points, see kernel.cpp
+template<typename T>
+struct stats_t {
+        int cnt_min, cnt_max;
+        T lo, hi;
+};
+using row_stats_t = stats_t<float>;
+
+// Sweeps the n points starting at c, which must be unit-stride along x
+// (Layout::TIME_MAJOR). Neighbour i is at c[off[i]], see neighbour_offsets.
+using row_kernel_t = void (*)(const float *c, const long *off, int n, row_stats_t &st);
+
+// "auto" picks the widest kernel the cpu supports; "scalar", "avx2" and
+// "avx512" force one. Each comes specialised for the number of neighbours
+// (neighbour_count). Returns nullptr for an unknown/unsupported name.
+row_kernel_t select_row_kernel(const char *name, int stencil, bool temporal);
+
+// The neighbours of a point with an n-point stencil: the first n - 1 of
+// DIRECTIONS, and with temporal its own values at t - 1 and t + 1 after them.
+inline int neighbour_count(int n, bool temporal) { return n - 1 + 2 * temporal; }
+
 typedef struct _config_t {
-        int offset;
-        int chunk_idx, chunk_cnt;
+        MPI_Comm comm; // the px * py * pz Cartesian grid, which everything runs on
 
         int px, py, pz;
         int nx, ny, nz;
         int nstep; // no. of time steps
+        Elem elem; // what the values are stored as
+
+        Layout layout;
+        int stencil; // 7, 19 or 27 points, see DIRECTIONS
+        bool temporal; // the stencil reaches t - 1 and t + 1 too
+        row_kernel_t row_kernel;
+        long mem_budget; // bytes per rank
+        int threads; // per rank, the main one included
+        long cache; // bytes of L2 the interior tiles are sized for
+        bool shared_halo; // on-node halos through shared memory
+        const char *hints_file; // MPI-IO hints, see io.cpp
+        bool io_tune;
+        bool mmap_input; // map the input instead of going through MPI-IO, see begin_read
+        bool huge_pages; // for the mapping
+        MPI_Offset data_offset; // where the values start in the input, see format.cpp
+        bool compressed; // and if they're deflated chunks
         
         const char* input_file;
         const char* output_file;
+        const char* extrema_file; // where every extremum goes, if anywhere, see write_extrema
 } config_t;
 
+// What a point is, as a bitmask: both for a point with no neighbours
+const uint32_t EXTREMUM_MIN = 1;
+const uint32_t EXTREMUM_MAX = 2;
+
+// One local extremum, where it is in the volume. The value is as computed on,
+// cut down to a float for f64 inputs: the exact one is in the input
+struct extremum_t {
+        int32_t x, y, z, t;
+        float value;
+        uint32_t kind; // EXTREMUM_*
+};
+static_assert(sizeof(extremum_t) == 24);
+
 template<typename T>
 struct answer_t {
-        std::vector<int> cnt_min, cnt_max;
+        std::vector<long> cnt_min, cnt_max; // a big enough volume has more than 2^31
         std::vector<T> gmin, gmax;
 
         int steps;
 
         std::array<double, 3> times { 0 , 0, 0 };
 
+        // with locate the sweeps record every extremum they count too, at its
+        // place in the block (perform moves them into the volume). they stay
+        // on their rank, pack() leaves them out
+        bool locate = false;
+        std::vector<extremum_t> extrema;
+
         answer_t(int nsteps) :
                 cnt_min(nsteps, 0), cnt_max(nsteps, 0),
                 gmin(nsteps, std::numeric_limits<T>::max()), 
@@ -224,9 +689,317 @@ struct answer_t {
                 for (int i = 0; i < 3; i++) {
                         times[i] += other.times[i];
                 }
+                extrema.insert(extrema.end(), other.extrema.begin(), other.extrema.end());
                 return *this;
         }
 
+        // The answer as one flat buffer, for reducing it in one go with combine:
+        // steps, then cnt_min, cnt_max, gmin, gmax and times, back to back
+        static size_t packed_size(int steps) {
+                return sizeof(long) + steps * (2 * sizeof(long) + 2 * sizeof(T)) + sizeof(times);
+        }
+
+        std::vector<char> pack() const {
+                std::vector<char> buf(packed_size(steps));
+                char *p = buf.data();
+                auto put = [&p](const void *src, size_t n) { memcpy(p, src, n); p += n; };
+
+                const long n = steps;
+                put(&n, sizeof(n));
+                put(cnt_min.data(), steps * sizeof(long));
+                put(cnt_max.data(), steps * sizeof(long));
+                put(gmin.data(), steps * sizeof(T));
+                put(gmax.data(), steps * sizeof(T));
+                put(times.data(), sizeof(times));
+                return buf;
+        }
+
+        static answer_t unpack(const char *p) {
+                auto get = [&p](void *dst, size_t n) { memcpy(dst, p, n); p += n; };
+
+                long n;
+                get(&n, sizeof(n));
+                answer_t ans(n);
+                get(ans.cnt_min.data(), n * sizeof(long));
+                get(ans.cnt_max.data(), n * sizeof(long));
+                get(ans.gmin.data(), n * sizeof(T));
+                get(ans.gmax.data(), n * sizeof(T));
+                get(ans.times.data(), sizeof(times));
+                return ans;
+        }
+
+        // MPI_User_function over packed answers (*len of them, each one element
+        // of *type): the counts add up, the extremes fold and the times are the
+        // slowest rank's
+        static void combine(void *in, void *inout, int *len, MPI_Datatype *type) {
+                for (int i = 0; i < *len; i++) {
+                        char *a = static_cast<char*>(in), *b = static_cast<char*>(inout);
+                        long n;
+                        memcpy(&n, a, sizeof(n));
+                        a += i * packed_size(n);
+                        b += i * packed_size(n);
+
+                        answer_t x = unpack(a), y = unpack(b);
+                        const auto times = y.times;
+                        y += x;
+                        for (int j = 0; j < 3; j++) y.times[j] = std::max(times[j], x.times[j]);
+
+                        const std::vector<char> r = y.pack();
+                        memcpy(b, r.data(), r.size());
+                }
+        }
 };
 
+// sweeps one shell region with an n-point stencil, in time too if temporal
+template<typename T>
+void sweep_region(const Region &r, Block<T> &data, Halo<T> &halo, Point bound,
+                int steps, int n, bool temporal, answer_t<T> &ans);
+
+// the L2 size, see tile.cpp
+long cache_size();
+// the interior tile of a block with the given bound (of value_sz byte values)
+// whose planes fit cache
+Point tile_shape(Point bound, int steps, long cache, int value_sz = sizeof(float));
+// the offsets into data of the neighbours (see neighbour_count) of a point at
+// timestep t. a missing neighbour in time (at the first and last timestep)
+// repeats neighbour 0 instead, which makes no difference to the outcome
+template<typename T>
+void neighbour_offsets(const Block<T> &data, int n, bool temporal, int t, int steps,
+                long *off);
+// sweeps the interior points in [lo, hi) with an n-point stencil, in storage
+// order. kernel (for the same stencil) is only used for Layout::TIME_MAJOR,
+// and only on floats
+template<typename T>
+void sweep_tile(const Block<T> &data, Point lo, Point hi, int steps, int n,
+                bool temporal, row_kernel_t kernel, answer_t<T> &ans);
+
+/*
+ * A fixed set of worker threads with a work-stealing scheduler: every thread
+ * has its own deque of jobs, works off the back of it, and when it runs dry
+ * steals from the front of the others'. The thread that made the pool is
+ * thread 0 and joins in through help() and wait(); it is also the only one
+ * that talks to MPI (MPI_THREAD_FUNNELED), and the only one to submit. Jobs
+ * get the number of the thread running them, to pick their per-thread state by.
+ */
+class Pool final {
+private:
+        using job_t = std::function<void(int)>;
+
+        struct alignas(64) queue_t {
+                std::mutex lock;
+                std::deque<job_t> jobs;
+                double busy = 0; // seconds spent in jobs by this queue's thread
+        };
+
+        std::vector<std::thread> workers;
+        std::unique_ptr<queue_t[]> queues;
+        int next = 0; // where the next job goes, round robin
+
+        std::atomic<int> queued { 0 }; // sitting in the deques
+        std::atomic<int> pending { 0 }; // submitted and not done yet
+        std::mutex sleep;
+        std::condition_variable wake, idle;
+        bool stop = false;
+
+        bool take(int id, job_t &job);
+        void run(int id, job_t &job);
+        void work(int id);
+public:
+        // threads counts the calling thread, so 1 makes a pool without workers
+        explicit Pool(int threads);
+        ~Pool();
+
+        int size() const { return workers.size() + 1; }
+
+        void submit(job_t job);
+        // runs one queued job on the calling thread, false if there was none
+        bool help();
+        // helps until every job submitted so far is done
+        void wait();
+
+        // per thread, the time spent running jobs since the last call
+        std::vector<double> busy();
+};
+
+// per-rank busy and idle time of the sweeps, summed over the steps
+struct load_t {
+        double wall = 0; // of the sweeps, halo waits included
+        std::vector<double> busy; // per thread
+
+        void add(double w, const std::vector<double> &b) {
+                wall += w;
+                busy.resize(b.size());
+                for (size_t i = 0; i < b.size(); i++) busy[i] += b[i];
+        }
+};
+
+// gathers every rank's load_t and prints where the time went, on rank 0
+void report_load(const load_t &load, MPI_Comm comm);
+
+/*
+ * The container the input can come in instead of raw values (see format.cpp,
+ * and scripts/pack.py for making one): a file_header_t, the chunk index, and
+ * the chunks. A chunk is a box of the volume, chunk[0] x chunk[1] x chunk[2]
+ * points (less at the far edges) with all their timesteps, in file layout;
+ * the index has them z-major like the points, at 64-bit offsets. Plain
+ * chunks are whole planes, back to back, so they read like a raw file;
+ * with FILE_DEFLATE each is a zlib stream of its own, see read_chunks.
+ * Everything is little-endian.
+ */
+#define FILE_MAGIC "PRLLZ\0\0\0"
+const uint32_t FILE_VERSION = 2;
+const uint32_t FILE_CRC = 1; // the chunks have CRC-32s, of what's in the file
+const uint32_t FILE_DEFLATE = 2; // the chunks are compressed
+
+struct file_header_t {
+        char magic[8]; // FILE_MAGIC
+        uint32_t version;
+        uint32_t elem; // an Elem
+        uint32_t layout; // 0 for [z][y][x][t], the only one there is
+        uint32_t flags; // FILE_*
+        int32_t nx, ny, nz, nstep;
+        uint32_t chunk[3]; // along x, y, z
+        uint32_t chunks;
+        uint64_t index; // offset of the chunk index, chunks of them
+};
+static_assert(sizeof(file_header_t) == 64);
+
+struct chunk_t {
+        uint64_t offset, size; // bytes in the file
+        uint32_t crc; // with FILE_CRC
+        uint32_t reserved;
+};
+static_assert(sizeof(chunk_t) == 24);
+
+// what read_header found, empty for a raw file
+struct container_t {
+        Point chunk { 0, 0, 0 }; // a chunk's extent
+        Point count { 0, 0, 0 }; // chunks along each axis
+        uint32_t flags = 0;
+        std::vector<chunk_t> chunks;
+
+        // the chunk at (cx, cy, cz) in the chunk grid
+        const chunk_t &at(int cx, int cy, int cz) const {
+                return chunks[(static_cast<long>(cz) * count[1] + cy) * count[0] + cx];
+        }
+};
+
+// Reads the header and index of config.input_file, if it's a container, into
+// config (dims, elem, data_offset and compressed) and c. Dims given on the
+// command line have to agree with the header. Returns false, having said why,
+// if they don't, or the file can't be opened or is broken. Collective.
+bool read_header(config_t &config, container_t &c, MPI_Comm comm);
+// checks the chunks' CRCs, spread over the ranks. Collective
+bool verify_chunks(const config_t &config, const container_t &c, MPI_Comm comm);
+// inflates a deflated chunk of size bytes at src into the n bytes at dst,
+// false if it doesn't come out at exactly n
+bool inflate_chunk(const void *src, long size, void *dst, long n);
+
+// this rank's part of the volume
+struct part_t {
+        Point bound;    // size of the sub-domain
+        int start[4];   // where it starts in the volume, as (z, y, x, t) like the file
+        std::vector<int> neighbours; // convention: x -1, y -1, z -1, x +1, y +1, z +1
+};
+
+/*
+ * One step of the sliding window a rank moves up its sub-domain, in planes of
+ * the volume across the axis it slides along (ctx_t::axis). The step evaluates
+ * [lo, hi), so its block holds [lo - 1, hi + 1): a plane of context on either
+ * side. The two lowest planes of that are the two highest of the previous
+ * step's block and are carried over in memory, only [r0, r1) is read from the
+ * file. Planes of the window that are neither (off the volume) are NaN, see
+ * Halo for why that works.
+ */
+struct window_t {
+        int lo, hi;
+        int r0, r1;
+        int carry; // planes carried over, 0 for the first step and 2 after
+};
+
+/*
+ * What the chunk loop keeps across steps: the open file, and everything that
+ * only depends on the window geometry - the file view, the sub-domain buffers
+ * and the halo exchange with its persistent requests. Steps mostly share one
+ * geometry, so these are built once or twice per run instead of per step.
+ */
+template<typename T, typename S = T> // computed on as T, stored as S
+struct ctx_t {
+        MPI_File fh;
+        MPI_Info info;
+        MPI_Request read = MPI_REQUEST_NULL; // the read in flight, if any
+
+        // whether reads go through the staging block (and can be prefetched)
+        // or straight into data
+        bool staged = false;
+        int axis = 2; // the window slides along z (2) or y (1)
+
+        // the read side, built for reads of read_nz planes
+        int read_nz = 0;
+        MPI_Datatype filetype = MPI_DATATYPE_NULL;
+        std::unique_ptr<Block<S>> staging; // file layout, the other half of the double buffer
+        std::unique_ptr<Block<S>> input; // the whole input, if it's mapped
+        const container_t *container = nullptr; // its chunks, if they're compressed
+        std::map<long, std::unique_ptr<Block<S>>> inflated; // those the window overlaps, by index
+
+        // the compute side, built for windows nz planes deep
+        int nz = 0;
+        part_t part;
+        std::unique_ptr<Block<T>> data;
+        std::unique_ptr<Halo<T>> halo;
+
+        std::unique_ptr<Pool> pool; // sweeps the block
+        load_t load;
+        node_t node; // where data lives, if the halo goes through shared memory
+
+        void release() {
+                if (halo) halo->free();
+                halo.reset();
+                data.reset();
+                input.reset();
+                inflated.clear();
+                if (filetype != MPI_DATATYPE_NULL) MPI_Type_free(&filetype);
+                if (node.win != MPI_WIN_NULL) {
+                        MPI_Win_unlock_all(node.win);
+                        MPI_Win_free(&node.win);
+                        MPI_Comm_free(&node.comm);
+                }
+                nz = read_nz = 0;
+        }
+};
+
+/*
+ * The file --extrema writes: an extrema_header_t, then count extremum_t
+ * records, every rank's in a run of their own (in rank order of the grid)
+ * and sorted z, y, x, t like the input within it. Little-endian.
+ */
+#define EXTREMA_MAGIC "PRLLZEXT"
+const uint32_t EXTREMA_VERSION = 1;
+const uint32_t EXTREMA_TEMPORAL = 1; // found with the temporal stencil
+
+struct extrema_header_t {
+        char magic[8]; // EXTREMA_MAGIC
+        uint32_t version;
+        uint32_t flags; // EXTREMA_*
+        int32_t nx, ny, nz, nstep;
+        int32_t stencil;
+        uint32_t reserved;
+        uint64_t count; // of records
+};
+static_assert(sizeof(extrema_header_t) == 48);
+
+// Writes every rank's extrema (sorted on the way) to config.extrema_file,
+// each at its own offset, no gathering. Collective over config.comm.
+void write_extrema(const config_t &config, std::vector<extremum_t> &found);
+
+// The MPI-IO hints to open the input with: the defaults, the hints file and
+// $PRLLZ_IO_HINTS, and tuned ones if config.io_tune. Collective.
+MPI_Info io_hints(const config_t &config, const part_t &part);
+
+// Picks the axis and the steps of the sliding window that keep every rank within
+// config.mem_budget, sets ctx.axis and ctx.staged to match and reports the plan.
+// ctx.part must be set. Collective.
+template<typename T, typename S>
+std::vector<window_t> plan_windows(const config_t &config, ctx_t<T, S> &ctx);
+
 #endif // _DEFS_H
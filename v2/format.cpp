@@ -0,0 +1,160 @@
+/*
+ * format.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+#include <zlib.h>
+
+// A plain container (see file_header_t) only wraps the values: once the
+// header says where they start and how big the volume is, the reads are the
+// same as for a raw file, just data_offset further in. That needs the chunks
+// to be whole planes back to back in z order, which is how scripts/pack.py
+// writes them. Deflated chunks can be any box, the ranks read and inflate the
+// ones their windows overlap (see read_chunks in main.cpp), so they're best
+// cut along the rank grid.
+
+bool read_header(config_t &config, container_t &c, MPI_Comm comm)
+{
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        // rank 0 reads, everybody gets the header (all zeros for a raw file)
+        // and the index
+        file_header_t h { };
+        int opened = 1;
+        if (rank == 0) {
+                FILE *f = fopen(config.input_file, "rb");
+                opened = f != nullptr;
+                if (!f || fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, FILE_MAGIC, 8)) {
+                        memset(&h, 0, sizeof(h));
+                } else {
+                        c.chunks.resize(h.chunks);
+                        if (fseeko(f, h.index, SEEK_SET)
+                                        || fread(c.chunks.data(), sizeof(chunk_t), h.chunks, f) != h.chunks)
+                                h.chunks = 0;
+                }
+                if (f) fclose(f);
+        }
+        MPI_Bcast(&opened, 1, MPI_INT, 0, comm);
+        if (!opened) {
+                if (rank == 0) fprintf(stderr, "can't open %s\n", config.input_file);
+                return false;
+        }
+        MPI_Bcast(&h, sizeof(h), MPI_BYTE, 0, comm);
+
+        int *dims[4] = { &config.nx, &config.ny, &config.nz, &config.nstep };
+        if (memcmp(h.magic, FILE_MAGIC, 8)) {
+                // raw values, the command line is all there is to go by
+                for (int *d: dims)
+                        if (*d <= 0) {
+                                if (rank == 0)
+                                        fprintf(stderr, "%s has no header, it needs nx ny nz nstep\n",
+                                                        config.input_file);
+                                return false;
+                        }
+                return true;
+        }
+
+        auto fail = [&](const char *why) {
+                if (rank == 0) fprintf(stderr, "%s: %s\n", config.input_file, why);
+                return false;
+        };
+        if (h.version != FILE_VERSION) return fail("unknown version");
+        if (h.layout != 0 || h.elem > static_cast<uint32_t>(Elem::BF16)) return fail("bad header");
+        if (h.nx <= 0 || h.ny <= 0 || h.nz <= 0 || h.nstep <= 0 || !h.chunk[0] || !h.chunk[1]
+                        || !h.chunk[2])
+                return fail("bad header");
+
+        const int32_t given[4] = { h.nx, h.ny, h.nz, h.nstep };
+        for (int i = 0; i < 4; i++) {
+                if (*dims[i] && *dims[i] != given[i])
+                        return fail("the header has other dims than the command line");
+                *dims[i] = given[i];
+        }
+
+        const Point n { h.nx, h.ny, h.nz };
+        for (int a = 0; a < 3; a++) {
+                c.chunk[a] = std::min<uint32_t>(h.chunk[a], n[a]);
+                c.count[a] = (n[a] + c.chunk[a] - 1) / c.chunk[a];
+        }
+        if (h.chunks != static_cast<uint32_t>(!c.count))
+                return fail("the chunk index is missing or short");
+        c.chunks.resize(h.chunks);
+        MPI_Bcast(c.chunks.data(), h.chunks * sizeof(chunk_t), MPI_BYTE, 0, comm);
+        c.flags = h.flags;
+
+        config.elem = static_cast<Elem>(h.elem);
+        config.data_offset = c.chunks[0].offset;
+        config.compressed = h.flags & FILE_DEFLATE;
+        if (config.compressed) return true;
+
+        // plain chunks are read as if there were none
+        const uint64_t plane = static_cast<uint64_t>(h.nx) * h.ny * h.nstep
+                * elem_size(config.elem);
+        if (c.chunk[0] != h.nx || c.chunk[1] != h.ny)
+                return fail("plain chunks have to be whole planes");
+        for (int k = 0; k < c.count[2]; k++) {
+                const uint64_t planes = std::min(c.chunk[2], h.nz - k * c.chunk[2]);
+                if (c.chunks[k].offset != config.data_offset + k * c.chunk[2] * plane
+                                || c.chunks[k].size != planes * plane)
+                        return fail("the chunks aren't back to back");
+        }
+        return true;
+}
+
+bool verify_chunks(const config_t &config, const container_t &c, MPI_Comm comm)
+{
+        int rank, sz;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &sz);
+
+        if (!(c.flags & FILE_CRC)) {
+                if (rank == 0)
+                        fprintf(stderr, "warning: %s has no checksums to verify\n", config.input_file);
+                return true;
+        }
+
+        MPI_File fh;
+        if (MPI_File_open(comm, config.input_file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh)
+                        != MPI_SUCCESS)
+                return false;
+
+        // every rank its own chunks, round robin, in pieces MPI can count
+        const long piece = 1L << 30;
+        long bad = 0;
+        std::vector<unsigned char> buf;
+        for (size_t k = rank; k < c.chunks.size(); k += sz) {
+                const chunk_t &ch = c.chunks[k];
+                uLong crc = crc32(0, Z_NULL, 0);
+                for (uint64_t at = 0; at < ch.size; at += piece) {
+                        const long n = std::min<uint64_t>(piece, ch.size - at);
+                        buf.resize(n);
+                        MPI_File_read_at(fh, ch.offset + at, buf.data(), n, MPI_BYTE,
+                                        MPI_STATUS_IGNORE);
+                        crc = crc32(crc, buf.data(), n);
+                }
+                if (crc != ch.crc) {
+                        fprintf(stderr, "%s: chunk %zu is corrupt\n", config.input_file, k);
+                        bad++;
+                }
+        }
+        MPI_File_close(&fh);
+
+        MPI_Allreduce(MPI_IN_PLACE, &bad, 1, MPI_LONG, MPI_SUM, comm);
+        if (rank == 0)
+                printf("verify: %zu chunk%s, %ld bad\n", c.chunks.size(),
+                                c.chunks.size() == 1 ? "" : "s", bad);
+        return bad == 0;
+}
+
+bool inflate_chunk(const void *src, long size, void *dst, long n)
+{
+        // uncompress() counts in uLong, which is 64 bits here
+        uLongf out = n;
+        return uncompress(static_cast<Bytef*>(dst), &out, static_cast<const Bytef*>(src), size) == Z_OK
+                && static_cast<long>(out) == n;
+}
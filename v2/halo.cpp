@@ -8,77 +8,217 @@
 #include "defs.h"
 
 template <typename T>
-Halo<T>::Halo(Block<T> _data, std::vector<int> _neighbours,
-                int _rank, Point _bound, int _steps) : 
+Halo<T>::Halo(Block<T> &_data, std::vector<int> _neighbours, MPI_Comm _comm,
+                int _rank, Point _bound, int _steps, int n, const node_t *_node) :
         data { _data },
         neighbours { _neighbours },
         bound { _bound },
         steps { _steps },
-        my_rank { _rank }
+        comm { _comm },
+        my_rank { _rank },
+        node { _node }
 {
+        // the stencil doesn't reach the rest, as far as the exchange is
+        // concerned there's nobody there
+        for (int i = n - 1; i < DIRS; i++) neighbours[i] = MPI_PROC_NULL;
+
+        // which neighbours share our node, going by their rank there
+        if (node) {
+                MPI_Group world, local;
+                MPI_Comm_group(comm, &world);
+                MPI_Comm_group(node->comm, &local);
+
+                int local_rank[DIRS];
+                MPI_Group_translate_ranks(world, DIRS, neighbours.data(), local, local_rank);
+                for (int i = 0; i < DIRS; i++) {
+                        if (neighbours[i] == MPI_PROC_NULL || local_rank[i] == MPI_UNDEFINED)
+                                continue;
+
+                        MPI_Aint sz;
+                        int unit;
+                        void *seg;
+                        MPI_Win_shared_query(node->win, local_rank[i], &sz, &unit, &seg);
+                        peers[i] = seg;
+                        shared |= 1 << i;
+                }
+
+                MPI_Group_free(&world);
+                MPI_Group_free(&local);
+        }
+
         // halo exchange
-        // first we perform non-blocking sends on the data
-        // xy, yz, zx refers to the planes we are going to send
-        MPI_Type_vector(bound[1] * bound[2], steps,
-                        bound[0] * steps, MPI_FLOAT, &halo_yz);
-        MPI_Type_vector(bound[0] * bound[1], steps,
-                        steps, MPI_FLOAT, &halo_xy);
-        MPI_Type_vector(bound[2], steps * bound[0],
-                        bound[1] * bound[0] * steps, MPI_FLOAT, &halo_zx);
-        MPI_Type_commit(&halo_xy);
-        MPI_Type_commit(&halo_yz);
-        MPI_Type_commit(&halo_zx);
-
-        MPI_Request _rst;
-        MPI_Isend(&data(0, 0, 0, 0), 1, halo_yz, neighbours[0],
-                        neighbours[0] + MAGIC, MPI_COMM_WORLD, &_rst); 
-        MPI_Isend(&data(0, 0, 0, 0), 1, halo_zx, neighbours[1],
-                        neighbours[1] + MAGIC, MPI_COMM_WORLD, &_rst);
-        MPI_Isend(&data(0, 0, 0, 0), 1, halo_xy, neighbours[2],
-                        neighbours[2] + MAGIC, MPI_COMM_WORLD, &_rst); 
-
-        MPI_Isend(&data(0, bound[0] - 1, 0, 0), 1, halo_yz, neighbours[3],
-                        neighbours[3] + MAGIC, MPI_COMM_WORLD, &_rst);
-        MPI_Isend(&data(0, 0, bound[1] - 1, 0), 1, halo_zx, neighbours[4],
-                        neighbours[4] + MAGIC, MPI_COMM_WORLD, &_rst);
-        MPI_Isend(&data(0, 0, 0, bound[2] - 1), 1, halo_xy, neighbours[5],
-                        neighbours[5] + MAGIC, MPI_COMM_WORLD, &_rst);
-
-        // convention: x -1, y -1, z -1, x +1, y +1, z +1
-        halo_recv.push_back(std::move(Block2D<T>(bound[1], bound[2], steps)));
-        halo_recv.push_back(std::move(Block2D<T>(bound[0], bound[2], steps)));
-        halo_recv.push_back(std::move(Block2D<T>(bound[0], bound[1], steps)));
-        halo_recv.push_back(std::move(Block2D<T>(bound[1], bound[2], steps)));
-        halo_recv.push_back(std::move(Block2D<T>(bound[0], bound[2], steps)));
-        halo_recv.push_back(std::move(Block2D<T>(bound[0], bound[1], steps)));
-
-        for (int i = 0; i < 6; i++) requests[i] = MPI_REQUEST_NULL; 
+        // what goes each way is the part of the block on that side: a plane
+        // for a face, a line along the free axis for an edge, one point for a
+        // corner. they're described as subarrays of the block, so they follow
+        // whatever layout the block is in
+        for (int i = 0; i < DIRS; i++) {
+                Point lo { 0, 0, 0 }, sub = bound;
+                for (int a = 0; a < 3; a++) {
+                        if (DIRECTIONS[i][a] == 0) continue;
+                        lo[a] = DIRECTIONS[i][a] < 0 ? 0 : bound[a] - 1;
+                        sub[a] = 1;
+                }
+                types[i] = data.subarray(lo, sub, elem_traits<T>::mpi());
+                MPI_Type_commit(&types[i]);
+        }
+
+        // persistent sends: the block's buffer stays put for as long as this
+        // halo lives, every chunk just refills it and start()s them again.
+        // on-node neighbours only get told that it's ready, and tell us when
+        // they're done with it
+        for (int i = 0; i < DIRS; i++) {
+                sends[i] = done_sends[i] = done_recvs[i] = MPI_REQUEST_NULL;
+                if (neighbours[i] == MPI_PROC_NULL) continue;
+
+                if (shared & 1 << i) {
+                        MPI_Send_init(nullptr, 0, MPI_BYTE, neighbours[i],
+                                        neighbours[i] + MAGIC, comm, &sends[i]);
+                        MPI_Send_init(nullptr, 0, MPI_BYTE, neighbours[i],
+                                        neighbours[i] + MAGIC_DONE, comm, &done_sends[i]);
+                        MPI_Recv_init(nullptr, 0, MPI_BYTE, neighbours[i],
+                                        my_rank + MAGIC_DONE, comm, &done_recvs[i]);
+                } else {
+                        MPI_Send_init(data.data, 1, types[i], neighbours[i],
+                                        neighbours[i] + MAGIC, comm, &sends[i]);
+                }
+        }
+
+        // the received halos are laid out the same way as our block, which is
+        // also the order in which the sender's subarray type packs them: the
+        // axes the halo runs along, lowest first, as a and b of a Block2D. the
+        // shared ones are read in place and don't need any
+        const Layout layout = data.get_layout();
+        for (int i = 0; i < DIRS; i++) {
+                int dim[2] = { 1, 1 }, axis[2] = { -1, -1 }, k = 0;
+                for (int a = 0; a < 3; a++)
+                        if (DIRECTIONS[i][a] == 0) {
+                                axis[k] = a;
+                                dim[k++] = bound[a];
+                        }
+
+                if (shared & 1 << i || i >= n - 1)
+                        halo_recv.push_back(Block2D<T>(0, 0, steps, layout));
+                else
+                        halo_recv.push_back(Block2D<T>(dim[0], dim[1], steps, layout));
+
+                const Block<T> &r = halo_recv[i].block;
+                long s[3] = { 0, 0, 0 };
+                if (axis[0] >= 0) s[axis[0]] = r.sx;
+                if (axis[1] >= 0) s[axis[1]] = r.sy;
+                planes[i] = plane_t<T> { r.data, r.st, s[0], s[1], s[2] };
+        }
+
+        // halos with nobody on the other side are filled with NaNs: they fail
+        // every comparison, so the stencil drops them without checking
+        for (int i = 0; i < DIRS; i++) {
+                if (neighbours[i] == MPI_PROC_NULL)
+                        std::fill(halo_recv[i].block.data, halo_recv[i].block.data + halo_recv[i].block.size(),
+                                        std::numeric_limits<T>::quiet_NaN());
+        }
+
+        for (int i = 0; i < DIRS; i++) {
+                requests[i] = MPI_REQUEST_NULL;
+                if (neighbours[i] != MPI_PROC_NULL)
+                        MPI_Recv_init(halo_recv[i].block.data, halo_recv[i].block_sz * steps,
+                                        elem_traits<T>::mpi(), neighbours[i], my_rank + MAGIC,
+                                        comm, &requests[i]);
+        }
+}
+
+// points halo i at the facing part of the neighbour's block, as its header
+// describes it right now
+template <typename T>
+void Halo<T>::attach(int i)
+{
+        node_t::header_t h;
+        memcpy(&h, peers[i], sizeof(h));
+        const T *peer = reinterpret_cast<const T*>(static_cast<const char*>(peers[i]) + node_t::HEADER);
+
+        // along each axis the halo crosses, we face their high plane if they're
+        // below us and their low one if above. along the others it runs with us
+        const long s[3] = { h.sx, h.sy, h.sz };
+        long base = 0, run[3] = { 0, 0, 0 };
+        for (int a = 0; a < 3; a++) {
+                if (DIRECTIONS[i][a] < 0) base += (h.bound[a] - 1) * s[a];
+                if (DIRECTIONS[i][a] == 0) run[a] = s[a];
+        }
+        planes[i] = plane_t<T> { peer + base, h.st, run[0], run[1], run[2] };
 }
 
 template <typename T>
-void Halo<T>::recv() {
-        for (int i = 0; i < 6; i++) {
-                if (neighbours[i] != MPI_PROC_NULL) {
-                        MPI_Irecv(&halo_recv[i].block.data[0], halo_recv[i].block_sz * steps, 
-                                         MPI_FLOAT,
-                                       neighbours[i], my_rank + MAGIC,
-                                      MPI_COMM_WORLD, &requests[i]);
+void Halo<T>::arrive(int i)
+{
+        arrived |= 1 << i;
+        if (shared & 1 << i) {
+                // their writes to the block before the message are ours to see now
+                MPI_Win_sync(node->win);
+                attach(i);
+        }
+}
+
+template <typename T>
+void Halo<T>::start() {
+        // tell the neighbours on the node how to find their way around our block
+        if (node) {
+                const node_t::header_t h { data.st, data.sx, data.sy, data.sz,
+                        { bound[0], bound[1], bound[2] } };
+                memcpy(node->segment, &h, sizeof(h));
+                MPI_Win_sync(node->win);
+        }
+
+        arrived = 0;
+        for (int i = 0; i < DIRS; i++) {
+                if (neighbours[i] == MPI_PROC_NULL) {
+                        arrived |= 1 << i; // nothing to wait for, the NaNs are in place
+                } else {
+                        MPI_Start(&requests[i]);
+                        MPI_Start(&sends[i]);
+                        if (shared & 1 << i) MPI_Start(&done_recvs[i]);
                 }
-        } 
+        }
 }
 
 template <typename T>
-void Halo<T>::wait() {
-        MPI_Waitall(6, requests, MPI_STATUSES_IGNORE);
+int Halo<T>::poll() {
+        int cnt, idx[DIRS];
+        MPI_Testsome(DIRS, requests, &cnt, idx, MPI_STATUSES_IGNORE);
+        if (cnt != MPI_UNDEFINED)
+                for (int i = 0; i < cnt; i++) arrive(idx[i]);
+        return arrived;
+}
+
+template <typename T>
+int Halo<T>::wait_any() {
+        int idx;
+        MPI_Waitany(DIRS, requests, &idx, MPI_STATUS_IGNORE);
+        if (idx != MPI_UNDEFINED) arrive(idx);
+        return arrived;
+}
+
+template <typename T>
+void Halo<T>::finish() {
+        MPI_Waitall(DIRS, requests, MPI_STATUSES_IGNORE);
+        MPI_Waitall(DIRS, sends, MPI_STATUSES_IGNORE);
+
+        if (!shared) return;
+
+        // we're through with the neighbours' blocks, and they have to be
+        // through with ours before it gets refilled
+        for (int i = 0; i < DIRS; i++)
+                if (shared & 1 << i) MPI_Start(&done_sends[i]);
+        MPI_Waitall(DIRS, done_sends, MPI_STATUSES_IGNORE);
+        MPI_Waitall(DIRS, done_recvs, MPI_STATUSES_IGNORE);
+        MPI_Win_sync(node->win);
 }
 
 template <typename T>
 void Halo<T>::free()
 {
-        MPI_Type_free(&halo_xy);
-        MPI_Type_free(&halo_yz);
-        MPI_Type_free(&halo_zx);
+        for (int i = 0; i < DIRS; i++) {
+                if (requests[i] != MPI_REQUEST_NULL) MPI_Request_free(&requests[i]);
+                if (sends[i] != MPI_REQUEST_NULL) MPI_Request_free(&sends[i]);
+                if (done_sends[i] != MPI_REQUEST_NULL) MPI_Request_free(&done_sends[i]);
+                if (done_recvs[i] != MPI_REQUEST_NULL) MPI_Request_free(&done_recvs[i]);
+                MPI_Type_free(&types[i]);
+        }
 }
-
-        
-        
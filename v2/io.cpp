@@ -0,0 +1,294 @@
+/*
+ * io.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+// The MPI-IO hints the input is opened with. They start out as DEFAULT_HINTS,
+// which is what used to be hard-coded; a hints file (--hints=<file> or
+// $PRLLZ_HINTS, a "key value" per line, # for comments) goes on top of those,
+// and $PRLLZ_IO_HINTS ("key=value,key=value") on top of that. --io=tune then
+// picks cb_nodes and cb_buffer_size, see tune_io.
+//
+// Rank 0 does the reading and the others get its text: the hints of a
+// collective open have to agree.
+
+using hints_t = std::vector<std::pair<std::string, std::string>>;
+
+static const hints_t DEFAULT_HINTS {
+        { "romio_cb_read", "enable" },
+        { "romio_cb_write", "enable" },
+        { "cb_buffer_size", "16777216" },
+        { "cb_nodes", "4" },
+        { "romio_ds_read", "enable" },
+        { "romio_no_indep_rw", "true" },
+};
+
+static void set_hint(hints_t &hints, const std::string &key, const std::string &value)
+{
+        for (auto &h: hints)
+                if (h.first == key) {
+                        h.second = value;
+                        return;
+                }
+        hints.push_back({ key, value });
+}
+
+static const std::string &get_hint(const hints_t &hints, const std::string &key)
+{
+        static const std::string none;
+        for (auto &h: hints)
+                if (h.first == key) return h.second;
+        return none;
+}
+
+// rank 0's string, everywhere
+static std::string share(std::string s, MPI_Comm comm)
+{
+        int len = s.size();
+        MPI_Bcast(&len, 1, MPI_INT, 0, comm);
+        s.resize(len);
+        MPI_Bcast(s.data(), len, MPI_CHAR, 0, comm);
+        return s;
+}
+
+static hints_t load_hints(const config_t &config)
+{
+        int rank;
+        MPI_Comm_rank(config.comm, &rank);
+
+        // every line "key value", whatever the source
+        std::string text;
+        if (rank == 0) {
+                if (config.hints_file) {
+                        std::ifstream in(config.hints_file);
+                        if (!in)
+                                fprintf(stderr, "warning: can't read hints file %s\n",
+                                                config.hints_file);
+                        std::string line;
+                        while (std::getline(in, line)) {
+                                line = line.substr(0, line.find('#'));
+                                text += line + "\n";
+                        }
+                }
+                if (const char *env = getenv("PRLLZ_IO_HINTS")) {
+                        std::string s = env;
+                        std::replace(s.begin(), s.end(), ',', '\n');
+                        std::replace(s.begin(), s.end(), '=', ' ');
+                        text += s + "\n";
+                }
+        }
+        text = share(text, config.comm);
+
+        hints_t hints = DEFAULT_HINTS;
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+                std::istringstream words(line);
+                std::string key, value;
+                if (words >> key >> value) set_hint(hints, key, value);
+        }
+        return hints;
+}
+
+static MPI_Info make_info(const hints_t &hints)
+{
+        MPI_Info info;
+        MPI_Info_create(&info);
+        for (auto &[key, value]: hints)
+                MPI_Info_set(info, key.c_str(), value.c_str());
+        return info;
+}
+
+// Seconds to read a sample of the input with the given hints: the first planes
+// of every rank's sub-domain, the way the windows read them, up to about
+// SAMPLE_SZ in all. The slowest rank's time counts.
+static double time_read(const config_t &config, const part_t &part, const hints_t &hints)
+{
+        const long plane = static_cast<long>(config.nx) * config.ny * config.nstep
+                * elem_size(config.elem);
+        const int depth = std::clamp(static_cast<int>(SAMPLE_SZ / plane / config.pz), 1,
+                        part.bound[2]);
+
+        MPI_Datatype filetype;
+        int sizes[4] = { config.nz, config.ny, config.nx, config.nstep };
+        int subsizes[4] = { depth, part.bound[1], part.bound[0], config.nstep };
+        int starts[4] = { part.start[0], part.start[1], part.start[2], 0 };
+        MPI_Type_create_subarray(4, sizes, subsizes, starts, MPI_ORDER_C, elem_mpi(config.elem),
+                        &filetype);
+        MPI_Type_commit(&filetype);
+
+        const long cnt = static_cast<long>(depth) * part.bound[1] * part.bound[0] * config.nstep;
+        std::vector<char> buf(cnt * elem_size(config.elem));
+
+        MPI_Info info = make_info(hints);
+        MPI_File fh;
+        MPI_File_open(config.comm, config.input_file, MPI_MODE_RDONLY, info, &fh);
+        MPI_File_set_view(fh, config.data_offset, elem_mpi(config.elem), filetype, "native",
+                        MPI_INFO_NULL);
+
+        MPI_Barrier(config.comm);
+        double t = MPI_Wtime();
+        MPI_File_read_all(fh, buf.data(), cnt, elem_mpi(config.elem), MPI_STATUS_IGNORE);
+        t = MPI_Wtime() - t;
+        MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, config.comm);
+
+        MPI_File_close(&fh);
+        MPI_Info_free(&info);
+        MPI_Type_free(&filetype);
+        return t;
+}
+
+// Picks cb_nodes and cb_buffer_size for this (file size, rank count) out of a
+// few candidates, by timing a sample read with each, and remembers the winner
+// in the cache file ($PRLLZ_IO_CACHE, IO_CACHE by default) for next time.
+// The sample is read once up front so they all find it in the page cache: what
+// gets compared is how the ranks and aggregators get along, not the disk.
+static void tune_io(const config_t &config, const part_t &part, hints_t &hints)
+{
+        int rank, sz;
+        MPI_Comm_rank(config.comm, &rank);
+        MPI_Comm_size(config.comm, &sz);
+
+        const char *cache = getenv("PRLLZ_IO_CACHE");
+        if (!cache) cache = IO_CACHE;
+
+        MPI_Offset file_sz;
+        {
+                MPI_File fh;
+                MPI_File_open(config.comm, config.input_file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+                MPI_File_get_size(fh, &file_sz);
+                MPI_File_close(&fh);
+        }
+
+        // a line per setting: file size, rank count, cb_nodes, cb_buffer_size
+        std::string hit;
+        if (rank == 0) {
+                std::ifstream in(cache);
+                long f, r;
+                std::string nodes, buffer;
+                while (in >> f >> r >> nodes >> buffer)
+                        if (f == file_sz && r == sz) hit = nodes + " " + buffer;
+        }
+        hit = share(hit, config.comm);
+
+        if (!hit.empty()) {
+                std::istringstream words(hit);
+                std::string nodes, buffer;
+                words >> nodes >> buffer;
+                set_hint(hints, "cb_nodes", nodes);
+                set_hint(hints, "cb_buffer_size", buffer);
+                if (rank == 0)
+                        printf("io: cb_nodes %s, cb_buffer_size %s from %s\n", nodes.c_str(),
+                                        buffer.c_str(), cache);
+                return;
+        }
+
+        time_read(config, part, hints);
+
+        double best = std::numeric_limits<double>::max();
+        std::string best_nodes, best_buffer;
+        for (int nodes = 1; ; nodes = std::min(2 * nodes, sz)) {
+                for (long buffer: { 4L << 20, 16L << 20, 64L << 20 }) {
+                        hints_t h = hints;
+                        set_hint(h, "cb_nodes", std::to_string(nodes));
+                        set_hint(h, "cb_buffer_size", std::to_string(buffer));
+
+                        // best of two, a single read is at the mercy of everything else
+                        const double t = std::min(time_read(config, part, h),
+                                        time_read(config, part, h));
+                        if (t < best) {
+                                best = t;
+                                best_nodes = get_hint(h, "cb_nodes");
+                                best_buffer = get_hint(h, "cb_buffer_size");
+                        }
+                }
+                if (nodes == sz) break;
+        }
+
+        set_hint(hints, "cb_nodes", best_nodes);
+        set_hint(hints, "cb_buffer_size", best_buffer);
+        if (rank == 0) {
+                printf("io: cb_nodes %s, cb_buffer_size %s, tuned (%.3g s per sample)\n",
+                                best_nodes.c_str(), best_buffer.c_str(), best);
+                std::ofstream out(cache, std::ios::app);
+                out << file_sz << " " << sz << " " << best_nodes << " " << best_buffer << "\n";
+        }
+}
+
+MPI_Info io_hints(const config_t &config, const part_t &part)
+{
+        hints_t hints = load_hints(config);
+
+        // deflated chunks aren't read the way the sample is, timing it says nothing
+        if (config.io_tune && config.compressed) {
+                int rank;
+                MPI_Comm_rank(config.comm, &rank);
+                if (rank == 0)
+                        fprintf(stderr, "warning: --io=tune doesn't work on compressed input, "
+                                        "not tuning\n");
+        } else if (config.io_tune) {
+                tune_io(config, part, hints);
+        }
+        return make_info(hints);
+}
+
+// Every rank's records go in one collective write at the offset an exclusive
+// scan over the counts gives it, so nothing goes through rank 0 but the header
+void write_extrema(const config_t &config, std::vector<extremum_t> &found)
+{
+        int rank;
+        MPI_Comm_rank(config.comm, &rank);
+
+        std::sort(found.begin(), found.end(), [](const extremum_t &a, const extremum_t &b) {
+                return std::tie(a.z, a.y, a.x, a.t) < std::tie(b.z, b.y, b.x, b.t);
+        });
+
+        long count = found.size(), first = 0, total = 0;
+        MPI_Exscan(&count, &first, 1, MPI_LONG, MPI_SUM, config.comm);
+        if (rank == 0) first = 0;
+        MPI_Allreduce(&count, &total, 1, MPI_LONG, MPI_SUM, config.comm);
+
+        MPI_File fh;
+        if (MPI_File_open(config.comm, config.extrema_file, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                                MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+                if (rank == 0) fprintf(stderr, "can't open %s\n", config.extrema_file);
+                return;
+        }
+        // whatever was there before goes
+        MPI_File_set_size(fh, sizeof(extrema_header_t) + total * sizeof(extremum_t));
+
+        if (rank == 0) {
+                extrema_header_t h { };
+                memcpy(h.magic, EXTREMA_MAGIC, 8);
+                h.version = EXTREMA_VERSION;
+                h.flags = config.temporal ? EXTREMA_TEMPORAL : 0;
+                h.nx = config.nx;
+                h.ny = config.ny;
+                h.nz = config.nz;
+                h.nstep = config.nstep;
+                h.stencil = config.stencil;
+                h.count = total;
+                MPI_File_write_at(fh, 0, &h, sizeof(h), MPI_BYTE, MPI_STATUS_IGNORE);
+        }
+
+        // a record per element keeps the count within an int
+        MPI_Datatype record;
+        MPI_Type_contiguous(sizeof(extremum_t), MPI_BYTE, &record);
+        MPI_Type_commit(&record);
+        MPI_File_write_at_all(fh, sizeof(extrema_header_t) + first * sizeof(extremum_t),
+                        found.data(), count, record, MPI_STATUS_IGNORE);
+        MPI_Type_free(&record);
+        MPI_File_close(&fh);
+
+        if (rank == 0)
+                printf("extrema: %ld written to %s\n", total, config.extrema_file);
+}
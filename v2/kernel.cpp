@@ -0,0 +1,185 @@
+/*
+ * kernel.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+// gcc 12 trips over the _mm512_undefined_*() placeholders inside the intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+// The comparisons against the neighbours have to stay in double precision:
+// the scalar code does `v > val - EPS` with EPS a double, and the counts must
+// come out bit-identical whatever kernel ends up running. So the vector kernels
+// widen the floats to doubles before comparing, 4 (avx2) or 8 (avx512) per
+// compare, and only the min/max fold stays in floats.
+
+// Every kernel is a template over the number of neighbours K (the stencil's,
+// plus two in time, see neighbour_offsets), so the loop over them has a fixed
+// trip count and unrolls: the 7-point version is the same code as one written
+// out by hand.
+
+template<int K>
+static void row_scalar(const float *c, const long *off, int n, row_stats_t &st)
+{
+        int cmin = 0, cmax = 0;
+        float lo = st.lo, hi = st.hi;
+
+        for (int x = 0; x < n; x++) {
+                float val = c[x];
+                lo = std::min(lo, val);
+                hi = std::max(hi, val);
+
+                bool lmin = true, lmax = true;
+                for (int i = 0; i < K; i++) {
+                        const float v = c[x + off[i]];
+                        lmax &= !(v > val - EPS);
+                        lmin &= !(v < val + EPS);
+                }
+
+                cmin += static_cast<int>(lmin);
+                cmax += static_cast<int>(lmax);
+        }
+
+        st.cnt_min += cmin;
+        st.cnt_max += cmax;
+        st.lo = lo;
+        st.hi = hi;
+}
+
+template<int K>
+__attribute__((target("avx2")))
+static void row_avx2(const float *c, const long *off, int n, row_stats_t &st)
+{
+        const __m256d eps = _mm256_set1_pd(EPS);
+
+        __m256 lo = _mm256_set1_ps(st.lo), hi = _mm256_set1_ps(st.hi);
+        int cmin = 0, cmax = 0;
+
+        int x = 0;
+        for (; x + 8 <= n; x += 8) {
+                __m256 val = _mm256_loadu_ps(c + x);
+                lo = _mm256_min_ps(val, lo);
+                hi = _mm256_max_ps(val, hi);
+
+                __m256d v0 = _mm256_cvtps_pd(_mm256_castps256_ps128(val));
+                __m256d v1 = _mm256_cvtps_pd(_mm256_extractf128_ps(val, 1));
+                __m256d below0 = _mm256_sub_pd(v0, eps), above0 = _mm256_add_pd(v0, eps);
+                __m256d below1 = _mm256_sub_pd(v1, eps), above1 = _mm256_add_pd(v1, eps);
+
+                // all ones to start with, cleared by any neighbour that disagrees
+                __m256d mx0 = _mm256_cmp_pd(v0, v0, _CMP_TRUE_UQ), mx1 = mx0;
+                __m256d mn0 = mx0, mn1 = mx0;
+
+                for (int i = 0; i < K; i++) {
+                        __m256 ng = _mm256_loadu_ps(c + x + off[i]);
+                        __m256d n0 = _mm256_cvtps_pd(_mm256_castps256_ps128(ng));
+                        __m256d n1 = _mm256_cvtps_pd(_mm256_extractf128_ps(ng, 1));
+
+                        // !(v > val - EPS) and !(v < val + EPS), NaNs included
+                        mx0 = _mm256_and_pd(mx0, _mm256_cmp_pd(n0, below0, _CMP_NGT_UQ));
+                        mx1 = _mm256_and_pd(mx1, _mm256_cmp_pd(n1, below1, _CMP_NGT_UQ));
+                        mn0 = _mm256_and_pd(mn0, _mm256_cmp_pd(n0, above0, _CMP_NLT_UQ));
+                        mn1 = _mm256_and_pd(mn1, _mm256_cmp_pd(n1, above1, _CMP_NLT_UQ));
+                }
+
+                cmax += __builtin_popcount(_mm256_movemask_pd(mx0) | (_mm256_movemask_pd(mx1) << 4));
+                cmin += __builtin_popcount(_mm256_movemask_pd(mn0) | (_mm256_movemask_pd(mn1) << 4));
+        }
+
+        alignas(32) float l[8], h[8];
+        _mm256_store_ps(l, lo);
+        _mm256_store_ps(h, hi);
+        for (int i = 0; i < 8; i++) {
+                st.lo = std::min(st.lo, l[i]);
+                st.hi = std::max(st.hi, h[i]);
+        }
+        st.cnt_min += cmin;
+        st.cnt_max += cmax;
+
+        if (x < n) row_scalar<K>(c + x, off, n - x, st);
+}
+
+template<int K>
+__attribute__((target("avx512f")))
+static void row_avx512(const float *c, const long *off, int n, row_stats_t &st)
+{
+        const __m512d eps = _mm512_set1_pd(EPS);
+
+        __m512 lo = _mm512_set1_ps(st.lo), hi = _mm512_set1_ps(st.hi);
+        int cmin = 0, cmax = 0;
+
+        int x = 0;
+        for (; x + 16 <= n; x += 16) {
+                __m512 val = _mm512_loadu_ps(c + x);
+                lo = _mm512_min_ps(val, lo);
+                hi = _mm512_max_ps(val, hi);
+
+                // widen each half straight from memory
+                __m512d v0 = _mm512_cvtps_pd(_mm256_loadu_ps(c + x));
+                __m512d v1 = _mm512_cvtps_pd(_mm256_loadu_ps(c + x + 8));
+                __m512d below0 = _mm512_sub_pd(v0, eps), above0 = _mm512_add_pd(v0, eps);
+                __m512d below1 = _mm512_sub_pd(v1, eps), above1 = _mm512_add_pd(v1, eps);
+
+                __mmask8 mx0 = 0xff, mx1 = 0xff, mn0 = 0xff, mn1 = 0xff;
+                for (int i = 0; i < K; i++) {
+                        __m512d n0 = _mm512_cvtps_pd(_mm256_loadu_ps(c + x + off[i]));
+                        __m512d n1 = _mm512_cvtps_pd(_mm256_loadu_ps(c + x + off[i] + 8));
+
+                        mx0 = _mm512_mask_cmp_pd_mask(mx0, n0, below0, _CMP_NGT_UQ);
+                        mx1 = _mm512_mask_cmp_pd_mask(mx1, n1, below1, _CMP_NGT_UQ);
+                        mn0 = _mm512_mask_cmp_pd_mask(mn0, n0, above0, _CMP_NLT_UQ);
+                        mn1 = _mm512_mask_cmp_pd_mask(mn1, n1, above1, _CMP_NLT_UQ);
+                }
+
+                cmax += __builtin_popcount(mx0 | (mx1 << 8));
+                cmin += __builtin_popcount(mn0 | (mn1 << 8));
+        }
+
+        alignas(64) float l[16], h[16];
+        _mm512_store_ps(l, lo);
+        _mm512_store_ps(h, hi);
+        for (int i = 0; i < 16; i++) {
+                st.lo = std::min(st.lo, l[i]);
+                st.hi = std::max(st.hi, h[i]);
+        }
+        st.cnt_min += cmin;
+        st.cnt_max += cmax;
+
+        if (x < n) row_scalar<K>(c + x, off, n - x, st);
+}
+
+template<int K>
+static row_kernel_t select_row_kernel(const char *name)
+{
+        if (!strcmp(name, "scalar"))
+                return row_scalar<K>;
+        if (!strcmp(name, "avx2"))
+                return __builtin_cpu_supports("avx2") ? row_avx2<K> : nullptr;
+        if (!strcmp(name, "avx512"))
+                return __builtin_cpu_supports("avx512f") ? row_avx512<K> : nullptr;
+        if (strcmp(name, "auto"))
+                return nullptr;
+
+        if (__builtin_cpu_supports("avx512f")) return row_avx512<K>;
+        if (__builtin_cpu_supports("avx2")) return row_avx2<K>;
+        return row_scalar<K>;
+}
+
+row_kernel_t select_row_kernel(const char *name, int stencil, bool temporal)
+{
+        switch (neighbour_count(stencil, temporal)) {
+        case 6: return select_row_kernel<6>(name);
+        case 8: return select_row_kernel<8>(name);
+        case 18: return select_row_kernel<18>(name);
+        case 20: return select_row_kernel<20>(name);
+        case 26: return select_row_kernel<26>(name);
+        case 28: return select_row_kernel<28>(name);
+        default: return nullptr;
+        }
+}
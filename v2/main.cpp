@@ -7,16 +7,47 @@
 
 #include "defs.h"
 
-answer_t<float> perform(config_t config);
+static bool choose_grid(config_t &config, int mpi_sz);
+static int choose_threads(const char *threads, int provided);
+static bool choose_elem(config_t &config, const char *type, bool known);
+part_t decompose(const config_t &config);
+template<typename T, typename S>
+static bool run(config_t &config, const char *input, const container_t &container);
+template<typename T, typename S>
+static void prepare(const config_t &config, const window_t &w, ctx_t<T, S> &ctx);
+template<typename T, typename S>
+static void begin_read(const config_t &config, const window_t &w, ctx_t<T, S> &ctx);
+template<typename T, typename S>
+static void advise_read(const window_t &w, const ctx_t<T, S> &ctx, int advice);
+template<typename T, typename S>
+static void read_chunks(const config_t &config, const window_t &w, ctx_t<T, S> &ctx);
+template<typename T, typename S>
+answer_t<T> perform(const config_t &config, const window_t &w, ctx_t<T, S> &ctx, double io_time);
+template<typename T>
+MPI_Request begin_reduce(const config_t &config, const answer_t<T> &ans,
+                std::vector<char> &send, std::vector<char> &buf);
 
 int main(int argc, char **argv) {
-        MPI_Init(&argc, &argv);
-        MPI_Errhandler_set(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+        // worker threads only compute, MPI stays on the main one
+        int provided;
+        MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
 
 
         config_t config { }; 
-        if (argc != 10) {
+        if (argc < 10) {
                 fprintf(stderr, "Usage: 9 args are required.\n");
+                fprintf(stderr, "A 0 for px, py or pz picks it to fit the rank count.\n");
+                fprintf(stderr, "Options (after the 9 args): --layout=time|file "
+                                "--kernel=auto|scalar|avx2|avx512 --stencil=7|19|27 --temporal "
+                                "--mem=<MB per rank> --threads=<n>|auto "
+                                "--halo=shared|messages --hints=<file> --io=default|tune "
+                                "--input=auto|mmap|mpiio --hugepages --type=auto|f32|f64|f16|bf16 "
+                                "--verify --extrema=<file>\n");
+                fprintf(stderr, "nx ny nz nstep may be 0 for an input with a header, see "
+                                "scripts/pack.py.\n");
+                fprintf(stderr, "The memory budget, thread count and hints file can also come from "
+                                "$PRLLZ_MEM (MB), $PRLLZ_THREADS and $PRLLZ_HINTS.\n");
                 return 0;
         }
 
@@ -30,53 +61,272 @@ int main(int argc, char **argv) {
         config.nstep = atoi(argv[8]);
         config.output_file = argv[9];
 
-        answer_t<float> ans { config.nstep };
+        config.layout = Layout::TIME_MAJOR;
+        config.stencil = 7;
+        const char *kernel = "auto";
+        config.mem_budget = MEM_BUDGET;
+        config.shared_halo = true;
+        if (const char *mem = getenv("PRLLZ_MEM"))
+                config.mem_budget = atof(mem) * 1024 * 1024;
+        const char *threads = getenv("PRLLZ_THREADS");
+        config.hints_file = getenv("PRLLZ_HINTS");
+        const char *input = "auto";
+        const char *type = "auto";
+        bool verify = false;
+        for (int i = 10; i < argc; i++) {
+                if (!strcmp(argv[i], "--layout=time")) {
+                        config.layout = Layout::TIME_MAJOR;
+                } else if (!strcmp(argv[i], "--layout=file")) {
+                        config.layout = Layout::FILE_ORDER;
+                } else if (!strncmp(argv[i], "--kernel=", 9)) {
+                        kernel = argv[i] + 9;
+                } else if (!strcmp(argv[i], "--temporal")) {
+                        config.temporal = true;
+                } else if (!strncmp(argv[i], "--stencil=", 10)) {
+                        config.stencil = atoi(argv[i] + 10);
+                        if (!valid_stencil(config.stencil)) {
+                                fprintf(stderr, "Stencil %s is not one of 7, 19, 27\n", argv[i] + 10);
+                                return 0;
+                        }
+                } else if (!strncmp(argv[i], "--mem=", 6)) {
+                        config.mem_budget = atof(argv[i] + 6) * 1024 * 1024;
+                } else if (!strcmp(argv[i], "--halo=shared")) {
+                        config.shared_halo = true;
+                } else if (!strcmp(argv[i], "--halo=messages")) {
+                        config.shared_halo = false;
+                } else if (!strncmp(argv[i], "--threads=", 10)) {
+                        threads = argv[i] + 10;
+                } else if (!strncmp(argv[i], "--hints=", 8)) {
+                        config.hints_file = argv[i] + 8;
+                } else if (!strcmp(argv[i], "--io=default")) {
+                        config.io_tune = false;
+                } else if (!strcmp(argv[i], "--io=tune")) {
+                        config.io_tune = true;
+                } else if (!strcmp(argv[i], "--input=auto") || !strcmp(argv[i], "--input=mmap")
+                                || !strcmp(argv[i], "--input=mpiio")) {
+                        input = argv[i] + 8;
+                } else if (!strcmp(argv[i], "--hugepages")) {
+                        config.huge_pages = true;
+                } else if (!strncmp(argv[i], "--type=", 7)) {
+                        type = argv[i] + 7;
+                } else if (!strcmp(argv[i], "--verify")) {
+                        verify = true;
+                } else if (!strncmp(argv[i], "--extrema=", 10)) {
+                        config.extrema_file = argv[i] + 10;
+                } else {
+                        fprintf(stderr, "Unknown option %s\n", argv[i]);
+                        return 0;
+                }
+        }
 
-        int mpi_rank;
+        // a header says what the volume is, and where its values are
+        container_t container;
+        if (!read_header(config, container, MPI_COMM_WORLD)) {
+                MPI_Finalize();
+                return 1;
+        }
+        if (!choose_elem(config, type, !container.chunks.empty())) {
+                MPI_Finalize();
+                return 1;
+        }
+        if (verify && !verify_chunks(config, container, MPI_COMM_WORLD)) {
+                MPI_Finalize();
+                return 1;
+        }
+
+        int mpi_rank, mpi_sz;
         MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &mpi_sz);
+
+        config.row_kernel = select_row_kernel(kernel, config.stencil, config.temporal);
+        if (!config.row_kernel) {
+                if (mpi_rank == 0) fprintf(stderr, "Kernel %s is not available\n", kernel);
+                MPI_Finalize();
+                return 1;
+        }
 
-        // Break down the volume along the z direction into "chunks"
-        // to ensure that no chunk has a size greater than MAX_DATA_SZ.
-        // Allows for limiting ram consumption.
-        std::vector<int> chunks_z;
-        config.chunk_cnt = 0;
-        config.chunk_idx = 0;
-        while (config.nz > 0) {
-                int cz = std::min(config.nz, 
-                                MAX_CHUNK_SZ / (config.nx * config.ny * VALUE_SZ * config.nstep)); 
-
-                config.nz -= cz;
-                chunks_z.push_back(cz);
-                config.chunk_cnt++;
+        if (!choose_grid(config, mpi_sz)) {
+                if (mpi_rank == 0)
+                        fprintf(stderr, "Can't lay %d ranks out as %d x %d x %d\n", mpi_sz,
+                                        config.px, config.py, config.pz);
+                MPI_Finalize();
+                return 1;
         }
 
-        int csz = chunks_z.size();
-        if (csz > 1) {
-               // we need to make the chunk's xy surfaces overlap 
-               for (int i = 1; i < csz - 1; i++) chunks_z[i] += 2;
-               chunks_z[0]++;
-               chunks_z[csz - 1]++;
+        // x varies fastest along the ranks, like the file does along the points,
+        // so consecutive ranks (likely on one node) share the x and y halos and
+        // node boundaries fall between z-layers. MPI may reorder on top of that
+        {
+                int dims[3] = { config.pz, config.py, config.px }, periods[3] = { 0, 0, 0 };
+                MPI_Cart_create(MPI_COMM_WORLD, 3, dims, periods, 1, &config.comm);
+        }
+        MPI_Comm_rank(config.comm, &mpi_rank);
+        config.threads = choose_threads(threads, provided);
+        config.cache = cache_size();
+        if (mpi_rank == 0)
+                printf("grid: %d x %d x %d, %d thread%s per rank\n", config.px, config.py,
+                                config.pz, config.threads, config.threads == 1 ? "" : "s");
+
+        // the rest is instantiated per element type, 16-bit ones are computed
+        // on as floats
+        bool ok = false;
+        switch (config.elem) {
+        case Elem::F32: ok = run<float, float>(config, input, container); break;
+        case Elem::F64: ok = run<double, double>(config, input, container); break;
+        case Elem::F16: ok = run<float, half_t>(config, input, container); break;
+        case Elem::BF16: ok = run<float, bfloat16_t>(config, input, container); break;
         }
 
-        printf("CSZ %d\n", csz);
+        MPI_Finalize();
+        return ok ? 0 : 1;
+}
 
-        config.offset = 0;
-        for (auto &cz: chunks_z) {
-                assert(cz > 2);
+// Everything past the setup, for values stored as S and computed on as T: the
+// window loop, the reduction and the output. False, said on rank 0, if the
+// input can't be opened.
+template<typename T, typename S>
+static bool run(config_t &config, const char *input, const container_t &container) {
+        int mpi_rank;
+        MPI_Comm_rank(config.comm, &mpi_rank);
+        answer_t<T> ans { config.nstep };
+
+        // every rank keeps its sub-domain for the whole run, and walks up it
+        // with a sliding window (see window_t)
+        ctx_t<T, S> ctx { };
+        ctx.part = decompose(config);
+        ctx.pool = std::make_unique<Pool>(config.threads);
+
+        // on a single node every rank can map the input and copy its windows
+        // straight out of the page cache, no MPI-IO and no collective buffering
+        // in between. it's all or nothing, if a rank can't map it nobody does.
+        // compressed chunks have to be read and inflated, mapping them is no help
+        if (config.compressed) {
+                ctx.container = &container;
+                config.mmap_input = false;
+        } else if (!strcmp(input, "auto")) {
+                MPI_Comm node;
+                int local, all;
+                MPI_Comm_split_type(config.comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+                MPI_Comm_size(node, &local);
+                MPI_Comm_size(config.comm, &all);
+                MPI_Comm_free(&node);
+                config.mmap_input = local == all;
+        } else {
+                config.mmap_input = !strcmp(input, "mmap");
+        }
+        if (config.mmap_input) {
+                ctx.input = std::make_unique<Block<S>>(Block<S>::map(config.input_file,
+                                        Point { config.nx, config.ny, config.nz }, config.nstep,
+                                        config.huge_pages, config.data_offset));
+                int mapped = ctx.input->data != nullptr;
+                MPI_Allreduce(MPI_IN_PLACE, &mapped, 1, MPI_INT, MPI_MIN, config.comm);
+                if (!mapped) {
+                        if (mpi_rank == 0)
+                                fprintf(stderr, "warning: can't map %s, reading it with MPI-IO\n",
+                                                config.input_file);
+                        ctx.input.reset();
+                        config.mmap_input = false;
+                }
+        }
 
-                config.nz = cz;
-                ans += perform(config);
+        // and how far it can go in one step decides how often it has to read
+        std::vector<window_t> windows = plan_windows(config, ctx);
+
+        // the blocks of the ranks on a node go in one shared window, where the
+        // neighbours read each other's faces in place (see Halo). the first
+        // window is the deepest, so its block is the biggest there will be
+        if (config.shared_halo) {
+                MPI_Comm_split_type(config.comm, MPI_COMM_TYPE_SHARED, mpi_rank,
+                                MPI_INFO_NULL, &ctx.node.comm);
+
+                Point bound = ctx.part.bound;
+                bound[ctx.axis] = windows[0].hi - windows[0].lo + 2;
+                const MPI_Aint bytes = node_t::HEADER + static_cast<MPI_Aint>(!bound)
+                        * config.nstep * sizeof(T);
+
+                // each segment close to its owner, rather than one contiguous run
+                MPI_Info info;
+                MPI_Info_create(&info);
+                MPI_Info_set(info, "alloc_shared_noncontig", "true");
+                MPI_Win_allocate_shared(bytes, 1, info, ctx.node.comm, &ctx.node.segment,
+                                &ctx.node.win);
+                MPI_Info_free(&info);
+
+                // passive target for good, the messages in Halo do the syncing
+                MPI_Win_lock_all(MPI_MODE_NOCHECK, ctx.node.win);
+        }
 
-                config.offset += (config.nx * config.ny * (config.nz - 2) * VALUE_SZ * config.nstep);
-                config.chunk_idx++;
+        // the hints go with the open, the views set per step don't repeat them
+        if (!config.mmap_input) {
+                ctx.info = io_hints(config, ctx.part);
+                int opened = MPI_File_open(config.comm, config.input_file, MPI_MODE_RDONLY,
+                                ctx.info, &ctx.fh) == MPI_SUCCESS;
+                MPI_Allreduce(MPI_IN_PLACE, &opened, 1, MPI_INT, MPI_MIN, config.comm);
+                if (!opened) {
+                        if (mpi_rank == 0) fprintf(stderr, "can't open %s\n", config.input_file);
+                        ctx.release();
+                        MPI_Info_free(&ctx.info);
+                        MPI_Comm_free(&config.comm);
+                        return false;
+                }
         }
-        
+
+        // With a staging block (file layout, see plan_windows) the next step is
+        // read into it while the current one computes out of ctx.data, so the two
+        // double-buffer each other. Without one, steps are read straight into
+        // ctx.data one after the other.
+        if (ctx.staged) begin_read(config, windows[0], ctx);
+
+        for (size_t k = 0; k < windows.size(); k++) {
+                const window_t &w = windows[k];
+                double io_start = MPI_Wtime();
+
+                prepare(config, w, ctx);
+                if (ctx.staged) {
+                        MPI_Wait(&ctx.read, MPI_STATUS_IGNORE);
+                        ctx.data->copy_planes(*ctx.staging, ctx.axis, 0, w.r0 - (w.lo - 1),
+                                        w.r1 - w.r0);
+
+                        // the staging block is free again, so the next step can
+                        // come in while this one computes
+                        if (k + 1 < windows.size())
+                                begin_read(config, windows[k + 1], ctx);
+                } else {
+                        begin_read(config, w, ctx);
+                        MPI_Wait(&ctx.read, MPI_STATUS_IGNORE);
+
+                        // a mapped input can't be read ahead, but the kernel
+                        // can page the next step in while this one computes
+                        if (ctx.input && k + 1 < windows.size())
+                                advise_read(windows[k + 1], ctx, MADV_WILLNEED);
+                }
+
+                ans += perform(config, w, ctx, MPI_Wtime() - io_start);
+        }
+
+        // the tear-down goes on while the answers are summed up
+        std::vector<char> send, reduced;
+        MPI_Request reduce = begin_reduce(config, ans, send, reduced);
+        report_load(ctx.load, config.comm);
+
+        ctx.release();
+        if (!config.mmap_input) {
+                MPI_File_close(&ctx.fh);
+                MPI_Info_free(&ctx.info);
+        }
+
+        // and so does the writing of the extrema
+        if (config.extrema_file) write_extrema(config, ans.extrema);
+
+        MPI_Wait(&reduce, MPI_STATUS_IGNORE);
+        if (mpi_rank == 0) ans = answer_t<T>::unpack(reduced.data());
+        MPI_Comm_free(&config.comm);
 
         if (mpi_rank == 0) {
                 FILE *fptr = fopen(config.output_file, "w");
 
                 for (int t = 0; t < config.nstep; t++) 
-                        fprintf(fptr, "(%d, %d) ", ans.cnt_min[t], ans.cnt_max[t]);
+                        fprintf(fptr, "(%ld, %ld) ", ans.cnt_min[t], ans.cnt_max[t]);
                 fprintf(fptr, "\n");
 
                 for (int t = 0; t < config.nstep; t++)
@@ -88,19 +338,108 @@ int main(int argc, char **argv) {
 
                 fclose(fptr);
         }
+        return true;
+}
 
-        MPI_Finalize();
+// Fills in whichever of px, py, pz are 0 so that the grid has mpi_sz ranks.
+// Out of the ways to factor it, this takes the one that cuts the volume along
+// the least area, i.e. has the least halo to exchange, and on a tie the one
+// cut least along x, which keeps the rows the kernels sweep long: a 32-rank
+// run on 64^3 gets 2 x 4 x 4, on 512 x 512 x 64 it gets 4 x 8 x 1.
+// MPI_Dims_create only balances the factors without looking at the volume,
+// so it's done by hand. Returns false if no grid fits.
+static bool choose_grid(config_t &config, int mpi_sz) {
+        const int fixed[3] = { config.px, config.py, config.pz };
+        const long n[3] = { config.nx, config.ny, config.nz };
+
+        long best = -1;
+        for (int px = mpi_sz; px >= 1; px--) for (int py = mpi_sz / px; py >= 1; py--) {
+                if (mpi_sz % (px * py)) continue;
+                const int p[3] = { px, py, mpi_sz / (px * py) };
+
+                bool ok = true;
+                for (int i = 0; i < 3; i++)
+                        ok &= (fixed[i] == 0 || fixed[i] == p[i]) && p[i] <= n[i];
+                if (!ok) continue;
+
+                const long area = (p[0] - 1) * n[1] * n[2] + (p[1] - 1) * n[0] * n[2]
+                        + (p[2] - 1) * n[0] * n[1];
+                if (best >= 0 && area > best) continue;
+
+                best = area;
+                config.px = p[0];
+                config.py = p[1];
+                config.pz = p[2];
+        }
+        return best >= 0;
 }
 
-answer_t<float> perform(config_t config) {
-        double start_time = MPI_Wtime(); 
+// Threads per rank: a count, or "auto" for the cores of the node shared out
+// between the ranks on it. One (pure MPI, as before) if not given, or if MPI
+// can't have threads around.
+static int choose_threads(const char *threads, int provided) {
+        if (!threads || provided < MPI_THREAD_FUNNELED) return 1;
+        if (strcmp(threads, "auto")) return std::max(1, atoi(threads));
 
-        int mpi_rank, mpi_sz;
-        MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
-        MPI_Comm_size(MPI_COMM_WORLD, &mpi_sz);
+        MPI_Comm node;
+        int local;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+        MPI_Comm_size(node, &local);
+        MPI_Comm_free(&node);
 
+        return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / local);
+}
+
+// What the input's values are stored as: named, or for "auto" what its size
+// says, which can tell 4 from 8 bytes but not a half from a bfloat16. If the
+// header has said already (known), a name has to agree with it. Returns false
+// (and says why, on rank 0) if it can't tell.
+static bool choose_elem(config_t &config, const char *type, bool known) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        const char *names[] = { "f32", "f64", "f16", "bf16" };
+        for (int i = 0; i < 4; i++)
+                if (!strcmp(type, names[i])) {
+                        if (known && config.elem != static_cast<Elem>(i)) {
+                                if (rank == 0)
+                                        fprintf(stderr, "%s has %s values, not %s\n",
+                                                        config.input_file,
+                                                        names[static_cast<int>(config.elem)], type);
+                                return false;
+                        }
+                        config.elem = static_cast<Elem>(i);
+                        return true;
+                }
+        if (strcmp(type, "auto")) {
+                if (rank == 0)
+                        fprintf(stderr, "Type %s is not one of auto, f32, f64, f16, bf16\n", type);
+                return false;
+        }
+        if (known) return true;
+
+        // a file that can't be looked at is left for the open to complain about
+        config.elem = Elem::F32;
+        struct stat st;
+        if (stat(config.input_file, &st)) return true;
+
+        const long values = static_cast<long>(config.nx) * config.ny * config.nz * config.nstep;
+        if (st.st_size == 8 * values) {
+                config.elem = Elem::F64;
+        } else if (st.st_size == 2 * values) {
+                if (rank == 0)
+                        fprintf(stderr, "%s has 16-bit values, say --type=f16 or --type=bf16\n",
+                                        config.input_file);
+                return false;
+        }
+        return true;
+}
+
+// this rank's part of the volume, from its place in the grid
+part_t decompose(const config_t &config) {
+        int mpi_rank;
+        MPI_Comm_rank(config.comm, &mpi_rank);
 
-        assert(mpi_sz == config.px * config.py * config.pz);
         //assert(config.nx % config.px == 0);
         //assert(config.ny % config.py == 0);
         //assert(config.nz % config.pz == 0);
@@ -109,235 +448,388 @@ answer_t<float> perform(config_t config) {
         Point bound { config.nx / config.px, config.ny / config.py,
                config.nz / config.pz }; 
 
-        std::vector rank_assgn(config.px, std::vector(config.py, std::vector<int>(config.pz)));
-        {
-                int rnk = 0;
-                for (int z = 0; z < config.pz; z++) for (int y = 0; y < config.py; y++)
-                       for (int x = 0; x < config.px; x++) {
-                              rank_assgn[x][y][z] = rnk;
-                              rnk = (rnk + 1) % mpi_sz;
-                       }
+        // the grid's dimensions are (z, y, x)
+        int coords[3];
+        MPI_Cart_coords(config.comm, mpi_rank, 3, coords);
+        const int x = coords[2], y = coords[1], z = coords[0];
+
+        int start_coords[4] = { z * bound[2], y * bound[1], x * bound[0], 0 };
+
+        if (x == config.px - 1 && config.nx % config.px) bound[0] += config.nx % config.px;
+        if (y == config.py - 1 && config.ny % config.py) bound[1] += config.ny % config.py;
+        if (z == config.pz - 1 && config.nz % config.pz) bound[2] += config.nz % config.pz;
+
+        // one per direction, in DIRECTIONS' order: the faces, edges and corners.
+        // the grid isn't periodic, so off its edges they're MPI_PROC_NULL
+        std::vector<int> neighbours(DIRS, MPI_PROC_NULL);
+        const int dims[3] = { config.px, config.py, config.pz };
+        for (int i = 0; i < DIRS; i++) {
+                int c[3] = { z + DIRECTIONS[i][2], y + DIRECTIONS[i][1], x + DIRECTIONS[i][0] };
+                bool inside = true;
+                for (int a = 0; a < 3; a++) inside &= c[2 - a] >= 0 && c[2 - a] < dims[a];
+                if (inside) MPI_Cart_rank(config.comm, c, &neighbours[i]);
         }
 
-        // convention: x -1, y -1, z -1, x +1, y +1, z +1
-        std::vector<int> neighbours(6, MPI_PROC_NULL);
-
-        int start_coords[4]; start_coords[3] = 0;
-        for (int z = 0; z < config.pz; z++) {
-                bool _tmp = false;
-                for (int y = 0; y < config.py; y++) {
-                for (int x = 0; x < config.px; x++) {
-                        if (rank_assgn[x][y][z] != mpi_rank) continue;
-
-                        start_coords[0] = z * bound[2];
-                        start_coords[1] = y * bound[1];
-                        start_coords[2] = x * bound[0];
-
-                        if (x == config.px - 1 && config.nx % config.px) bound[0] += config.nx % config.px;
-                        if (y == config.py - 1 && config.ny % config.py) bound[1] += config.ny % config.py;
-                        if (z == config.pz - 1 && config.nz % config.pz) bound[2] += config.nz % config.pz;
-
-                        if (x) neighbours[0] = rank_assgn[x - 1][y][z];
-                        if (y) neighbours[1] = rank_assgn[x][y - 1][z];
-                        if (z) neighbours[2] = rank_assgn[x][y][z - 1];
-                        if (x < config.px - 1) neighbours[3] = rank_assgn[x + 1][y][z];
-                        if (y < config.py - 1) neighbours[4] = rank_assgn[x][y + 1][z];
-                        if (z < config.pz - 1) neighbours[5] = rank_assgn[x][y][z + 1];
-
-                        _tmp = true;
-                        break;
-                }
-                if (_tmp) break;
+        return part_t { bound, { start_coords[0], start_coords[1], start_coords[2],
+                start_coords[3] }, neighbours };
+}
+
+// Gets ctx.data ready to take the window w: (re)builds the compute side if the
+// window's depth changed, carries over the planes the previous step left behind
+// and fills the ones off the volume.
+template<typename T, typename S>
+static void prepare(const config_t &config, const window_t &w, ctx_t<T, S> &ctx) {
+        const int depth = w.hi - w.lo + 2;
+
+        std::unique_ptr<Block<T>> stash;
+        if (ctx.nz != depth) {
+                // new geometry, the old requests don't fit anymore. the halo
+                // partners have the same windows, so they all rebuild together
+                if (ctx.halo) ctx.halo->free();
+                ctx.halo.reset();
+
+                // the new block can take over the old one's storage, so what
+                // gets carried over is put aside first
+                if (w.carry) {
+                        Point sub = ctx.data->get_bound();
+                        sub[ctx.axis] = w.carry;
+                        stash = std::make_unique<Block<T>>(sub, config.nstep, config.layout);
+                        stash->copy_planes(*ctx.data, ctx.axis, ctx.nz - w.carry, 0, w.carry);
                 }
-                if (_tmp) break;
-        }
 
-        MPI_Datatype filetype;
-        {
-                int sizes[4] = {config.nz, config.ny, config.nx, config.nstep};
-                int subsizes[4] = {bound[2], bound[1], bound[0], config.nstep};
-                MPI_Type_create_subarray(4, sizes, subsizes, start_coords, 
-                               MPI_ORDER_C, MPI_FLOAT, &filetype); 
+                int mpi_rank;
+                MPI_Comm_rank(config.comm, &mpi_rank);
+
+                // nothing to exchange along the window's axis, it brings its own planes
+                std::vector<int> neighbours = ctx.part.neighbours;
+                for (int i = 0; i < DIRS; i++)
+                        if (DIRECTIONS[i][ctx.axis]) neighbours[i] = MPI_PROC_NULL;
+
+                const bool shm = ctx.node.win != MPI_WIN_NULL;
+                Point bound = ctx.part.bound;
+                bound[ctx.axis] = depth;
+                ctx.data = std::make_unique<Block<T>>(bound, config.nstep, config.layout,
+                                shm ? ctx.node.template storage<T>() : nullptr);
+                ctx.halo = std::make_unique<Halo<T>>(*ctx.data, neighbours, config.comm,
+                                mpi_rank, bound, config.nstep, config.stencil,
+                                shm ? &ctx.node : nullptr);
+                ctx.nz = depth;
         }
-        MPI_Type_commit(&filetype);
 
-        MPI_File fh; 
+        Block<T> &data = *ctx.data;
+        if (stash)
+                data.copy_planes(*stash, ctx.axis, 0, 0, w.carry);
+        else if (w.carry)
+                data.copy_planes(data, ctx.axis, depth - w.carry, 0, w.carry);
 
-        MPI_Info info;
-        MPI_Info_create(&info);
-        MPI_Info_set(info, "romio_cb_read", "enable");
-        MPI_Info_set(info, "romio_cb_write", "enable");
-        MPI_Info_set(info, "cb_buffer_size", "16777216");
-        MPI_Info_set(info, "cb_nodes", "4");
-        MPI_Info_set(info, "romio_ds_read", "enable");
-        MPI_Info_set(info, "romio_no_indep_rw", "true");
+        const int base = w.lo - 1;
+        const T nan = std::numeric_limits<T>::quiet_NaN();
+        data.fill_planes(ctx.axis, w.carry, w.r0 - base - w.carry, nan);
+        data.fill_planes(ctx.axis, w.r1 - base, w.hi + 1 - w.r1, nan);
+}
 
-        MPI_File_open(MPI_COMM_WORLD, config.input_file, MPI_MODE_RDONLY, info, &fh);
-        MPI_File_set_view(fh, config.offset, MPI_FLOAT, filetype, "native", info);
+// the box of the volume the planes [w.r0, w.r1) of this rank's window cover
+template<typename T, typename S>
+static void read_box(const window_t &w, const ctx_t<T, S> &ctx, Point &lo, Point &n) {
+        lo = Point { ctx.part.start[2], ctx.part.start[1], ctx.part.start[0] };
+        lo[ctx.axis] = w.r0;
+        n = ctx.part.bound;
+        n[ctx.axis] = w.r1 - w.r0;
+}
 
-        Block<float> data(bound, config.nstep); // this rank's sub-domain
-        MPI_File_read_all(fh, &data.data[0], data.block_sz * config.nstep,
-                        MPI_FLOAT, MPI_STATUS_IGNORE);
+template<typename T, typename S>
+static void advise_read(const window_t &w, const ctx_t<T, S> &ctx, int advice) {
+        Point lo, n;
+        read_box(w, ctx, lo, n);
+        ctx.input->advise(lo, n, advice);
+}
 
-        double read_time = MPI_Wtime();
+// starts the collective read of the planes [w.r0, w.r1), into the staging
+// block if there is one and into their place in ctx.data if not. a mapped
+// input is copied in there and then, and leaves ctx.read alone. values that
+// are widened on the way in are always staged, see plan_windows
+template<typename T, typename S>
+static void begin_read(const config_t &config, const window_t &w, ctx_t<T, S> &ctx) {
+        const int cnt = w.r1 - w.r0;
+        Point sub = ctx.part.bound;
+        sub[ctx.axis] = cnt;
+
+        if (ctx.container) {
+                read_chunks(config, w, ctx);
+                return;
+        }
 
-        Halo<float> halo { data, neighbours, mpi_rank, bound, config.nstep };
-        halo.recv();
+        if (ctx.input) {
+                Point lo, n, to { 0, 0, 0 };
+                read_box(w, ctx, lo, n);
+                to[ctx.axis] = w.r0 - (w.lo - 1);
+                ctx.data->copy_box(*ctx.input, lo, to, n);
+                return;
+        }
 
-        // we perform computations on our local sub-domain while the recv's
-        // proceed asynchronously
-        answer_t<float> ans(config.nstep);
-
-        auto gen_neighs {
-                [](int x, int y, int z) -> auto {
-                        std::vector<std::array<int, 3>> neighs = {
-                                {x - 1, y, z},
-                                {x + 1, y, z},
-                                {x, y - 1, z},
-                                {x, y + 1, z},
-                                {x, y, z - 1},
-                                {x, y, z + 1}};
-                        // do we need move semantics here?
-                        // ig the copy might be elided, idk
-                        // update: yup, we don't need move semantics
-                        // according to the compiler warning it indeed stops
-                        // copy elision
-                        //return std::move(neighs);
-                        return neighs;
+        if (ctx.read_nz != cnt) {
+                if (ctx.filetype != MPI_DATATYPE_NULL) MPI_Type_free(&ctx.filetype);
+
+                // a window can be all carried planes at the top of the volume,
+                // the rank still has to take part in the read
+                if (cnt) {
+                        // the planes are found from the displacement below, so the
+                        // type can stay put along the axis
+                        int sizes[4] = {config.nz, config.ny, config.nx, config.nstep};
+                        int subsizes[4] = {sub[2], sub[1], sub[0], config.nstep};
+                        int starts[4] = {ctx.part.start[0], ctx.part.start[1], ctx.part.start[2], 0};
+                        starts[2 - ctx.axis] = 0;
+                        MPI_Type_create_subarray(4, sizes, subsizes, starts,
+                                       MPI_ORDER_C, elem_traits<S>::mpi(), &ctx.filetype);
+                        MPI_Type_commit(&ctx.filetype);
                 }
-        };
-
 
-        for (int x = 1; x < bound[0] - 1; x++) for (int y = 1; y < bound[1] - 1; y++)
-                for (int z = 1; z < bound[2] - 1; z++) for (int t = 0; t < config.nstep; t++) {
-                        float val = data(t, x, y, z);
-                        ans.gmin[t] = std::min(ans.gmin[t], val);
-                        ans.gmax[t] = std::max(ans.gmax[t], val);
+                if (ctx.staged)
+                        ctx.staging = std::make_unique<Block<S>>(sub, config.nstep,
+                                        Layout::FILE_ORDER);
+                ctx.read_nz = cnt;
+        }
 
-                        std::vector<std::array<int, 3>> neighs { gen_neighs(x, y, z) };
+        // straight into ctx.data, the planes go to their place in the window
+        const MPI_Datatype elem = elem_traits<S>::mpi();
+        MPI_Datatype memtype = elem;
+        if (!ctx.staged && cnt) {
+                Point lo { 0, 0, 0 };
+                lo[ctx.axis] = w.r0 - (w.lo - 1);
+                memtype = ctx.data->subarray(lo, sub, elem);
+                MPI_Type_commit(&memtype);
+        }
+        void *dst = ctx.staged ? static_cast<void*>(ctx.staging->data)
+                : static_cast<void*>(ctx.data->data);
+        const int count = ctx.staged ? cnt * sub[0] * sub[ctx.axis == 2 ? 1 : 2] * config.nstep
+                : cnt > 0;
+
+        // the view can't change under a pending read, which is why this is only
+        // called once the previous read is done. every rank's window starts at
+        // its own plane, hence the per-rank displacement
+        const long plane = ctx.axis == 2 ? static_cast<long>(config.nx) * config.ny : config.nx;
+        const MPI_Offset disp = config.data_offset + w.r0 * plane * config.nstep * sizeof(S);
+        MPI_File_set_view(ctx.fh, disp, elem, cnt ? ctx.filetype : elem,
+                        "native", MPI_INFO_NULL);
+        MPI_File_iread_all(ctx.fh, dst, count, memtype, &ctx.read);
+
+        // the pending read keeps what it needs of the type
+        if (memtype != elem) MPI_Type_free(&memtype);
+}
 
-                        bool lmin = true, lmax = true;
-                        for (auto &ng: neighs) {
-                                float v = data(t, ng[0], ng[1], ng[2]);
-                                //assert(fabs(v - val) > 0.001);
-                                //EPS stuff to deal with floating point error
-                                if (v > val - EPS) lmax = false;
-                                if (v < val + EPS) lmin = false;
-                        }
+// Copies the planes [w.r0, w.r1) of this rank's window out of the deflated
+// chunks they overlap, a chunk per job on the pool. A chunk is inflated whole
+// the first time a window needs it and kept in ctx.inflated until one doesn't
+// (the windows only move up), so chunks deeper than a window or spanning a
+// window's cross-section are only read and inflated once. The reads are
+// independent, the ranks of a z-layer may well want some of the same chunks
+// but nobody else's. Like a mapped input, it's all done by the time this
+// returns.
+template<typename T, typename S>
+static void read_chunks(const config_t &config, const window_t &w, ctx_t<T, S> &ctx) {
+        const container_t &c = *ctx.container;
+        Point lo, n;
+        read_box(w, ctx, lo, n);
+        if (!n == 0) return;
+
+        std::vector<Point> todo;
+        for (int cz = lo[2] / c.chunk[2]; cz <= (lo[2] + n[2] - 1) / c.chunk[2]; cz++)
+                for (int cy = lo[1] / c.chunk[1]; cy <= (lo[1] + n[1] - 1) / c.chunk[1]; cy++)
+                        for (int cx = lo[0] / c.chunk[0]; cx <= (lo[0] + n[0] - 1) / c.chunk[0]; cx++)
+                                todo.push_back(Point { cx, cy, cz });
+        auto index = [&c](const Point &k) {
+                return (static_cast<long>(k[2]) * c.count[1] + k[1]) * c.count[0] + k[0];
+        };
 
-                        ans.cnt_min[t] += static_cast<int>(lmin);
-                        ans.cnt_max[t] += static_cast<int>(lmax);
+        // the ones the window has moved past won't be needed again
+        std::erase_if(ctx.inflated, [&](const auto &kv) {
+                return std::none_of(todo.begin(), todo.end(),
+                                [&](const Point &k) { return index(k) == kv.first; });
+        });
+
+        // the new ones get a slot here, filled in by their job
+        std::vector<char> fresh(todo.size(), 0);
+        std::vector<std::vector<char>> packed(todo.size());
+        std::vector<MPI_Request> reads;
+        for (size_t i = 0; i < todo.size(); i++) {
+                if (ctx.inflated.count(index(todo[i]))) continue;
+                fresh[i] = 1;
+                ctx.inflated[index(todo[i])] = nullptr;
+
+                // in pieces MPI can count, like verify_chunks
+                const chunk_t &ch = c.at(todo[i][0], todo[i][1], todo[i][2]);
+                const long piece = 1L << 30;
+                packed[i].resize(ch.size);
+                for (uint64_t at = 0; at < ch.size; at += piece) {
+                        reads.push_back(MPI_REQUEST_NULL);
+                        MPI_File_iread_at(ctx.fh, ch.offset + at, packed[i].data() + at,
+                                        std::min<uint64_t>(piece, ch.size - at), MPI_BYTE,
+                                        &reads.back());
                 }
-
-        halo.wait();
-
-        static const Point origin { 0, 0, 0 };
-
-        const bool first_chunk = config.chunk_idx == 0;
-        const bool last_chunk = config.chunk_idx == (config.chunk_cnt - 1);
-
-        auto halo_process { 
-                [&bound, &data, &halo, &ans, &gen_neighs, &neighbours, 
-                        &first_chunk, &last_chunk]
-                        (int t, int x, int y, int z) -> void {
-                        float val = data(t, x, y, z);
-                        ans.gmin[t] = std::min(ans.gmin[t], val);
-                        ans.gmax[t] = std::max(ans.gmax[t], val);
-
-                        std::vector<std::array<int, 3>> neighs { gen_neighs(x, y, z) };
-
-                        std::vector<std::array<int, 3>> to_erase;
-                        for (int i = 0; i < 6; i++) {
-                                if (neighbours[i] == MPI_PROC_NULL) {
-                                        if (i == 0 && x == 0) to_erase.push_back({x - 1, y, z});
-                                        if (i == 1 && y == 0) to_erase.push_back({x, y - 1, z});
-                                        if (i == 2 && z == 0) {
-                                                if (first_chunk) 
-                                                        to_erase.push_back({x, y, z - 1});
-                                                else
-                                                        return;
-                                        }
-                                        if (i == 3 && x == bound[0] - 1) to_erase.push_back({x + 1, y, z});
-                                        if (i == 4 && y == bound[1] - 1) to_erase.push_back({x, y + 1, z});
-                                        if (i == 5 && z == bound[2] - 1) {
-                                                if (last_chunk)
-                                                        to_erase.push_back({x, y, z + 1});
-                                                else
-                                                        return;
-                                        }
+        }
+        MPI_Waitall(reads.size(), reads.data(), MPI_STATUSES_IGNORE);
+
+        // the box starts at plane w.r0 - (w.lo - 1) of the window
+        const Point volume { config.nx, config.ny, config.nz };
+        Point base { 0, 0, 0 };
+        base[ctx.axis] = w.r0 - (w.lo - 1);
+
+        Block<T> &data = *ctx.data;
+        Pool &pool = *ctx.pool;
+        std::atomic<int> bad { 0 };
+        for (size_t i = 0; i < todo.size(); i++) {
+                std::unique_ptr<Block<S>> *slot = &ctx.inflated[index(todo[i])];
+                pool.submit([&, i, slot](int) {
+                        std::unique_ptr<Block<S>> &chunk = *slot;
+                        // the chunk is a block of its own, and its part of the
+                        // box goes over
+                        Point origin, ext;
+                        for (int a = 0; a < 3; a++) {
+                                origin[a] = todo[i][a] * c.chunk[a];
+                                ext[a] = std::min(c.chunk[a], volume[a] - origin[a]);
+                        }
+                        if (fresh[i]) {
+                                chunk = std::make_unique<Block<S>>(ext, config.nstep);
+                                const bool ok = inflate_chunk(packed[i].data(), packed[i].size(),
+                                                chunk->data, chunk->size() * sizeof(S));
+                                packed[i] = std::vector<char>();
+                                if (!ok) {
+                                        bad++;
+                                        return;
                                 }
                         }
 
-                        for (auto &te: to_erase) 
-                               neighs.erase(std::find(neighs.begin(), neighs.end(), te)); 
+                        Point from, to, m;
+                        for (int a = 0; a < 3; a++) {
+                                const int s = std::max(lo[a], origin[a]);
+                                m[a] = std::min(lo[a] + n[a], origin[a] + ext[a]) - s;
+                                from[a] = s - origin[a];
+                                to[a] = s - lo[a] + base[a];
+                        }
+                        data.copy_box(*chunk, from, to, m);
+                });
+        }
+        pool.wait();
+        pool.busy(); // that was no sweep, see load_t
 
-                        bool lmin = true, lmax = true;
-                        for (auto &ng: neighs) {
-                                float v;
-                                Point p_ng { ng[0], ng[1], ng[2] };
+        if (bad) {
+                fprintf(stderr, "%s: %d chunk%s won't inflate\n", config.input_file,
+                                bad.load(), bad == 1 ? "" : "s");
+                MPI_Abort(config.comm, 1);
+        }
+}
 
-                                if (p_ng < bound && p_ng >= origin) 
-                                        v = data(t, ng[0], ng[1], ng[2]);
-                                else
-                                        v = halo(t, ng[0], ng[1], ng[2]);
+template<typename T, typename S>
+answer_t<T> perform(const config_t &config, const window_t &w, ctx_t<T, S> &ctx, double io_time) {
+        double read_time = MPI_Wtime();
 
-                                if (v > val - EPS) lmax = false;
-                                if (v < val + EPS) lmin = false;
-                        }
-                        
-                        ans.cnt_min[t] += static_cast<int>(lmin);
-                        ans.cnt_max[t] += static_cast<int>(lmax);
-                }
-        };
+        Block<T> &data = *ctx.data;
+        Halo<T> &halo = *ctx.halo;
+        Point bound = ctx.part.bound;
+        bound[ctx.axis] = ctx.nz;
 
-        // x = 0, x = bound[0] - 1
-        for (int y = 0; y < bound[1]; y++) for (int z = 0; z < bound[2]; z++) 
-                for (int t = 0; t < config.nstep; t++) {
-                        halo_process(t, 0, y, z);
-                        if (bound[0] - 1)
-                                halo_process(t, bound[0] - 1, y, z);
-                }
+        halo.start();
 
-        // y = 0, y = bound[1] - 1
-        for (int x = 1; x < bound[0] - 1; x++) for (int z = 0; z < bound[2]; z++)
-                for (int t = 0; t < config.nstep; t++) {
-                        halo_process(t, x, 0, z);
-                        if (bound[1] - 1)
-                                halo_process(t, x, bound[1] - 1, z);
+        // we perform computations on our local sub-domain while the recv's
+        // proceed asynchronously. every thread sweeps into its own answer,
+        // they're merged at the end
+        Pool &pool = *ctx.pool;
+        std::vector<answer_t<T>> partial(pool.size(), answer_t<T>(config.nstep));
+        for (auto &p: partial) p.locate = config.extrema_file != nullptr;
+
+        // shell regions are swept as soon as every halo they read is in:
+        // a face needs its own plane, an edge two (and the edge's line past
+        // 7 points) and a corner three (and more past 7 points). the
+        // window's first and last planes are only there as neighbours, so the
+        // regions on them are left out
+        std::vector<Region> pending = shell_regions(bound);
+        std::erase_if(pending, [&ctx](const Region &r) { return r.span[ctx.axis] != MID; });
+        auto sweep_ready {
+                [&pending, &pool, &data, &halo, &bound, &config, &partial](int arrived) -> void {
+                        std::erase_if(pending, [&](const Region &r) {
+                                const int needs = r.halos(config.stencil);
+                                if ((needs & arrived) != needs) return false;
+                                pool.submit([&, r](int id) {
+                                        sweep_region(r, data, halo, bound, config.nstep, config.stencil,
+                                                        config.temporal, partial[id]);
+                                });
+                                return true;
+                        });
                 }
+        };
 
-        // z = 0, z = bound[2] - 1
-        for (int x = 1; x < bound[0] - 1; x++) for (int y = 1; y < bound[1] - 1; y++)
-                for (int t = 0; t < config.nstep; t++) {
-                        halo_process(t, x, y, 0);
-                        if (bound[2] - 1)
-                                halo_process(t, x, y, bound[2] - 1);
+        // the interior goes in tiles whose planes fit the cache (see tile.cpp),
+        // all queued up front and spread over the threads' deques; idle threads
+        // steal. this thread (the one on MPI) takes them one at a time too,
+        // checking for arrived planes in between
+        sweep_ready(halo.arrived);
+        const Point tile = tile_shape(bound, config.nstep, config.cache, sizeof(T));
+        for (int z = 1; z < bound[2] - 1; z += tile[2]) for (int y = 1; y < bound[1] - 1; y += tile[1])
+                for (int x = 1; x < bound[0] - 1; x += tile[0]) {
+                        const Point lo { x, y, z };
+                        const Point hi { std::min(x + tile[0], bound[0] - 1),
+                                std::min(y + tile[1], bound[1] - 1), std::min(z + tile[2], bound[2] - 1) };
+                        pool.submit([&data, &config, &partial, lo, hi](int id) {
+                                sweep_tile(data, lo, hi, config.nstep, config.stencil, config.temporal,
+                                        config.row_kernel, partial[id]);
+                        });
                 }
+        while (pool.help())
+                sweep_ready(halo.poll());
+
+        // whatever is left waits on the stragglers
+        while (!pending.empty())
+                sweep_ready(halo.wait_any());
+        pool.wait();
+        ctx.load.add(MPI_Wtime() - read_time, pool.busy());
+        // our own sends have to be done before the next chunk refills the block
+        halo.finish();
+
+        answer_t<T> ans(config.nstep);
+        for (auto &p: partial) ans += p;
+
+        // the extrema were found in the block, whose first plane along the
+        // axis is the one below the window
+        Point origin { ctx.part.start[2], ctx.part.start[1], ctx.part.start[0] };
+        origin[ctx.axis] = w.lo - 1;
+        for (extremum_t &e: ans.extrema) {
+                e.x += origin[0];
+                e.y += origin[1];
+                e.z += origin[2];
+        }
 
         double out_time = MPI_Wtime();
 
-        ans.times[0] = read_time - start_time;
+        ans.times[0] = io_time;
         ans.times[1] = out_time - read_time;
-        ans.times[2] = out_time - start_time;
-
-        answer_t<float> reduced_ans { config.nstep };
-
-        MPI_Reduce(&ans.cnt_min[0], &reduced_ans.cnt_min[0], config.nstep, MPI_INT,
-                        MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce(&ans.cnt_max[0], &reduced_ans.cnt_max[0], config.nstep, MPI_INT,
-                        MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce(&ans.gmin[0], &reduced_ans.gmin[0], config.nstep, MPI_FLOAT,
-                       MPI_MIN, 0, MPI_COMM_WORLD);
-        MPI_Reduce(&ans.gmax[0], &reduced_ans.gmax[0], config.nstep, MPI_FLOAT,
-                        MPI_MAX, 0, MPI_COMM_WORLD);
-        MPI_Reduce(&ans.times[0], &reduced_ans.times[0], 3, MPI_DOUBLE,
-                        MPI_MAX, 0, MPI_COMM_WORLD);
+        ans.times[2] = io_time + ans.times[1];
 
-        halo.free();
-
-        MPI_Barrier(MPI_COMM_WORLD);
+        return ans;
+}
 
-        return reduced_ans;
+// Starts summing up every rank's answer on rank 0, where it lands in buf once
+// the request is done (see answer_t::unpack). It's only called once, after the
+// last step: until then each rank keeps adding its steps to its own. The whole
+// answer goes as one packed element, with answer_t::combine as the op.
+template<typename T>
+MPI_Request begin_reduce(const config_t &config, const answer_t<T> &ans,
+                std::vector<char> &send, std::vector<char> &buf) {
+        send = ans.pack();
+        buf.resize(send.size());
+
+        MPI_Datatype packed;
+        MPI_Type_contiguous(send.size(), MPI_BYTE, &packed);
+        MPI_Type_commit(&packed);
+        MPI_Op op;
+        MPI_Op_create(answer_t<T>::combine, 1, &op);
+
+        MPI_Request req;
+        MPI_Ireduce(send.data(), buf.data(), 1, packed, op, 0, config.comm, &req);
+
+        // both stay around for as long as the reduction needs them
+        MPI_Type_free(&packed);
+        MPI_Op_free(&op);
+        return req;
 }
 
 
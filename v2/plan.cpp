@@ -0,0 +1,153 @@
+/*
+ * plan.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+// The budget covers the blocks a rank holds at once: the window's, plus the
+// staging block the next step is read into while it computes. That one is
+// about as deep, so it's counted as a second window, of the values as they're
+// stored (half as big for 16-bit ones). Halo planes and the like are small
+// change next to them. Deflated chunks are inflated whole and kept until the
+// window has moved past them (see read_chunks), so for compressed input those
+// count too: the chunks' cross-section per plane, up to a chunk's depth either
+// side of the window, or all of them if that's less.
+template<typename T, typename S>
+std::vector<window_t> plan_windows(const config_t &config, ctx_t<T, S> &ctx)
+{
+        const Point &bound = ctx.part.bound;
+        const long point_sz = static_cast<long>(config.nstep) * sizeof(T);
+        const long stored_sz = static_cast<long>(config.nstep) * sizeof(S);
+
+        // the ways to slide, best first. z-planes are contiguous in the file,
+        // y-planes are runs of rows; x would cut the rows the kernels run along.
+        // file layout can read straight into the window when a staging block
+        // doesn't fit, time-major can't (the staging block does the transpose).
+        // a mapped input is copied out of the page cache, which needs neither.
+        // values that are widened on the way in have to be staged too.
+        // compressed chunks are inflated and copied in, like a mapping
+        std::vector<std::pair<int, bool>> options;
+        if (!config.mmap_input && !config.compressed)
+                options = { { 2, true }, { 1, true } };
+        if ((config.layout == Layout::FILE_ORDER && sizeof(S) == sizeof(T)) || config.mmap_input
+                        || config.compressed) {
+                options.push_back({ 2, false });
+                options.push_back({ 1, false });
+        }
+
+        auto plane_sz = [&](int axis, bool staged) {
+                return !bound / bound[axis] * (point_sz + (staged ? stored_sz : 0));
+        };
+
+        // along axis a, how much of the volume the chunks this rank's
+        // sub-domain overlaps cover
+        auto chunk_span = [&](int a) -> long {
+                const Point &c = ctx.container->chunk;
+                const Point n { config.nx, config.ny, config.nz };
+                const int lo = ctx.part.start[2 - a] / c[a] * c[a];
+                return std::min((ctx.part.start[2 - a] + bound[a] + c[a] - 1) / c[a] * c[a], n[a])
+                        - lo;
+        };
+        // the bytes of those chunks per plane across the axis
+        auto chunk_plane = [&](int axis) -> long {
+                if (!ctx.container) return 0;
+                long area = stored_sz;
+                for (int a = 0; a < 3; a++)
+                        if (a != axis) area *= chunk_span(a);
+                return area;
+        };
+        // the planes of kept chunks with a window depth planes deep: up to a
+        // chunk past either end of the planes it reads, but no more than
+        // there are
+        auto chunk_planes = [&](int axis, long depth) -> long {
+                if (!ctx.container) return 0;
+                return std::min(depth + 2 + 2L * (ctx.container->chunk[axis] - 1), chunk_span(axis));
+        };
+        auto used_sz = [&](int axis, bool staged, long depth) {
+                return (depth + 2) * plane_sz(axis, staged) + chunk_planes(axis, depth) * chunk_plane(axis);
+        };
+
+        // the deepest window that fits, from whichever bound on the chunks
+        // lets it go deeper
+        auto fit = [&](int axis, bool staged) -> long {
+                const long window = plane_sz(axis, staged), chunk = chunk_plane(axis);
+                long fit = config.mem_budget / window - 2;
+                if (ctx.container)
+                        fit = std::max((config.mem_budget - 2L * (ctx.container->chunk[axis] - 1) * chunk)
+                                        / (window + chunk) - 2,
+                                        (config.mem_budget - chunk_span(axis) * chunk) / window - 2);
+                return fit;
+        };
+
+        // per option, the steps this rank needs to stay within budget,
+        // (negated, to get the minimum) its depth along the axis and its plane
+        // size. every rank has to take the same steps, so the plan goes by the
+        // worst of them
+        std::vector<long> need;
+        for (auto [axis, staged]: options) {
+                const long depth = fit(axis, staged);
+                need.push_back(depth < 1 ? std::numeric_limits<int>::max()
+                                : (bound[axis] + depth - 1) / depth);
+                need.push_back(-bound[axis]);
+                need.push_back(plane_sz(axis, staged) + chunk_plane(axis));
+        }
+        MPI_Allreduce(MPI_IN_PLACE, need.data(), need.size(), MPI_LONG, MPI_MAX, config.comm);
+
+        // each step needs at least a plane on every rank, so the shallowest
+        // sub-domain caps the steps. if nothing fits, the smallest planes will
+        // have to do, one at a time
+        int pick = -1;
+        for (size_t i = 0; i < options.size() && pick < 0; i++)
+                if (need[3 * i] <= -need[3 * i + 1]) pick = i;
+
+        // the last two options are z and y on the least memory. it's the
+        // biggest planes that decide, and they're the same on every rank (the
+        // remainders make some sub-domains bigger than others)
+        bool over = pick < 0;
+        if (over) {
+                const size_t z = options.size() - 2, y = z + 1;
+                pick = need[3 * y + 2] < need[3 * z + 2] ? y : z;
+        }
+
+        const auto [axis, staged] = options[pick];
+        const int steps = std::min(need[3 * pick], -need[3 * pick + 1]);
+        ctx.axis = axis;
+        ctx.staged = staged;
+
+        std::vector<window_t> windows;
+        const int n = axis == 2 ? config.nz : config.ny, depth = bound[axis];
+        for (int k = 0, lo = ctx.part.start[2 - axis]; k < steps; k++) {
+                const int hi = lo + depth / steps + (k < depth % steps);
+                if (k == 0)
+                        windows.push_back(window_t { lo, hi, std::max(lo - 1, 0),
+                                        std::min(hi + 1, n), 0 });
+                else
+                        windows.push_back(window_t { lo, hi, lo + 1, std::min(hi + 1, n), 2 });
+                lo = hi;
+        }
+
+        long used = used_sz(axis, staged, windows[0].hi - windows[0].lo);
+        MPI_Allreduce(MPI_IN_PLACE, &used, 1, MPI_LONG, MPI_MAX, config.comm);
+
+        int mpi_rank;
+        MPI_Comm_rank(config.comm, &mpi_rank);
+        if (mpi_rank == 0) {
+                printf("plan: %d step%s along %c, %s, %.3g MB of %.3g MB per rank\n",
+                                steps, steps == 1 ? "" : "s", "xyz"[axis], config.mmap_input ? "mapped"
+                                : config.compressed ? "compressed" : staged ? "prefetch on" : "prefetch off",
+                                used / 1048576.0, config.mem_budget / 1048576.0);
+                if (over)
+                        fprintf(stderr, "warning: not even one plane per step fits the "
+                                        "memory budget\n");
+        }
+
+        return windows;
+}
+
+template std::vector<window_t> plan_windows(const config_t&, ctx_t<float, float>&);
+template std::vector<window_t> plan_windows(const config_t&, ctx_t<double, double>&);
+template std::vector<window_t> plan_windows(const config_t&, ctx_t<float, half_t>&);
+template std::vector<window_t> plan_windows(const config_t&, ctx_t<float, bfloat16_t>&);
@@ -0,0 +1,151 @@
+/*
+ * pool.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+Pool::Pool(int threads) : queues { std::make_unique<queue_t[]>(threads) }
+{
+        for (int i = 1; i < threads; i++)
+                workers.emplace_back(&Pool::work, this, i);
+}
+
+Pool::~Pool()
+{
+        {
+                std::lock_guard<std::mutex> guard { sleep };
+                stop = true;
+        }
+        wake.notify_all();
+        for (auto &w: workers) w.join();
+}
+
+// the back of our own deque, or else the front of someone else's
+bool Pool::take(int id, job_t &job)
+{
+        const int n = size();
+        for (int k = 0; k < n; k++) {
+                queue_t &q = queues[(id + k) % n];
+                std::lock_guard<std::mutex> guard { q.lock };
+                if (q.jobs.empty()) continue;
+
+                if (k == 0) {
+                        job = std::move(q.jobs.back());
+                        q.jobs.pop_back();
+                } else {
+                        job = std::move(q.jobs.front());
+                        q.jobs.pop_front();
+                }
+                queued--;
+                return true;
+        }
+        return false;
+}
+
+void Pool::run(int id, job_t &job)
+{
+        auto start = std::chrono::steady_clock::now();
+        job(id);
+        queues[id].busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (--pending == 0) {
+                std::lock_guard<std::mutex> guard { sleep };
+                idle.notify_all();
+        }
+}
+
+void Pool::work(int id)
+{
+        job_t job;
+        for (;;) {
+                if (take(id, job)) {
+                        run(id, job);
+                        continue;
+                }
+
+                std::unique_lock<std::mutex> held { sleep };
+                wake.wait(held, [this] { return stop || queued > 0; });
+                if (stop && queued == 0) return;
+        }
+}
+
+void Pool::submit(job_t job)
+{
+        pending++;
+        {
+                queue_t &q = queues[next];
+                std::lock_guard<std::mutex> guard { q.lock };
+                q.jobs.push_back(std::move(job));
+        }
+        next = (next + 1) % size();
+
+        {
+                std::lock_guard<std::mutex> guard { sleep };
+                queued++;
+        }
+        wake.notify_one();
+}
+
+bool Pool::help()
+{
+        job_t job;
+        if (!take(0, job)) return false;
+        run(0, job);
+        return true;
+}
+
+void Pool::wait()
+{
+        while (help());
+
+        std::unique_lock<std::mutex> held { sleep };
+        idle.wait(held, [this] { return pending == 0; });
+}
+
+std::vector<double> Pool::busy()
+{
+        std::vector<double> b(size());
+        for (int i = 0; i < size(); i++) {
+                b[i] = queues[i].busy;
+                queues[i].busy = 0;
+        }
+        return b;
+}
+
+void report_load(const load_t &load, MPI_Comm comm)
+{
+        int rank, sz;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &sz);
+
+        // per rank: wall, busy summed over the threads, the least and most busy
+        // thread, and how many there are
+        const int threads = load.busy.size();
+        double mine[5] = { load.wall, 0, load.busy[0], load.busy[0], static_cast<double>(threads) };
+        for (double b: load.busy) {
+                mine[1] += b;
+                mine[2] = std::min(mine[2], b);
+                mine[3] = std::max(mine[3], b);
+        }
+
+        std::vector<double> all(rank == 0 ? 5 * sz : 0);
+        MPI_Gather(mine, 5, MPI_DOUBLE, all.data(), 5, MPI_DOUBLE, 0, comm);
+        if (rank) return;
+
+        // idle is whatever of a thread's wall time it didn't spend in jobs: waiting
+        // on halos, or for the other threads to finish
+        double lo = all[1], hi = all[1], sum = 0;
+        for (int r = 0; r < sz; r++) {
+                const double *m = &all[5 * r];
+                lo = std::min(lo, m[1]);
+                hi = std::max(hi, m[1]);
+                sum += m[1];
+                printf("load: rank %d busy %.4f s idle %.4f s, per thread busy %.4f .. %.4f s\n",
+                                r, m[1], m[4] * m[0] - m[1], m[2], m[3]);
+        }
+        printf("load: busy per rank %.4f .. %.4f s (avg %.4f), imbalance %.2f\n",
+                        lo, hi, sum / sz, sum > 0 ? hi / (sum / sz) : 1.0);
+}
@@ -9,7 +9,7 @@
 #include "halo.cpp"
 
 template class Halo<float>;
-//template class Halo<double>;
+template class Halo<double>;
 
 // smh its back to floats again...
 //
@@ -0,0 +1,199 @@
+/*
+ * tile.cpp
+ * Group Prllz
+ *
+ * May 2025
+ */
+
+#include "defs.h"
+
+#include <type_traits>
+#include <unistd.h>
+
+// The interior is swept a tile at a time, in the order the block is stored in:
+// z outermost, then y, then x (and t innermost in file layout, outermost in
+// time-major, where every timestep is its own volume). Going up a tile a
+// z-plane at a time, the stencil reads the planes z - 1, z and z + 1, so once
+// the tile's planes (with a point of margin around them) fit the cache, each
+// point comes in from memory once instead of once per neighbour.
+
+long cache_size()
+{
+        const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        return l2 > 0 ? l2 : L2_SIZE;
+}
+
+Point tile_shape(Point bound, int steps, long cache, int value_sz)
+{
+        const Point inner { std::max(bound[0] - 2, 1), std::max(bound[1] - 2, 1),
+                std::max(bound[2] - 2, 1) };
+
+        // half the cache for the three planes, the rest is for everything else
+        // (the halo faces, the other thread on the core, ...)
+        const long room = cache / 2 / (3L * steps * value_sz);
+
+        // whole rows if at least a few of them fit, they're what the kernels
+        // stream along. the rows of a wide block get cut
+        Point tile;
+        tile[0] = std::min(inner[0], static_cast<int>(std::max(room / 4 - 2, 16L)));
+        tile[1] = std::clamp(static_cast<int>(room / (tile[0] + 2) - 2), 1, inner[1]);
+        // the depth doesn't matter to the cache, it's what decides how many
+        // tiles there are to go around the threads
+        tile[2] = std::min(inner[2], TILE_DEPTH);
+        return tile;
+}
+
+template<typename T>
+void neighbour_offsets(const Block<T> &data, int n, bool temporal, int t, int steps,
+                long *off)
+{
+        for (int i = 0; i < n - 1; i++)
+                off[i] = DIRECTIONS[i][0] * data.sx + DIRECTIONS[i][1] * data.sy
+                        + DIRECTIONS[i][2] * data.sz;
+        if (temporal) {
+                off[n - 1] = t > 0 ? -data.st : off[0];
+                off[n] = t + 1 < steps ? data.st : off[0];
+        }
+}
+
+// the point at c against its K neighbours, no branches: on noisy data they'd
+// go either way. what it turned out to be, as EXTREMUM_* bits
+template<int K, typename T>
+__attribute__((always_inline)) static inline uint32_t check(const T *c, const long *off,
+                stats_t<T> &st)
+{
+        T val = *c;
+        st.lo = std::min(st.lo, val);
+        st.hi = std::max(st.hi, val);
+
+        bool lmin = true, lmax = true;
+        for (int i = 0; i < K; i++) {
+                T v = c[off[i]];
+                //EPS stuff to deal with floating point error
+                lmax &= !(v > val - EPS);
+                lmin &= !(v < val + EPS);
+        }
+
+        st.cnt_min += static_cast<int>(lmin);
+        st.cnt_max += static_cast<int>(lmax);
+        return lmin * EXTREMUM_MIN | lmax * EXTREMUM_MAX;
+}
+
+// sweep_tile for answer_t::locate: a point at a time (the kernels only count),
+// recording the extrema as they're found
+template<int K, bool TIME, typename T>
+static void locate_tile(const Block<T> &data, Point lo, Point hi, int steps, int n,
+                answer_t<T> &ans)
+{
+        std::vector<long> offs(steps * K);
+        for (int t = 0; t < steps; t++)
+                neighbour_offsets(data, n, TIME, t, steps, &offs[t * K]);
+        std::vector<stats_t<T>> st(steps);
+        for (int t = 0; t < steps; t++) st[t] = stats_t<T> { 0, 0, ans.gmin[t], ans.gmax[t] };
+
+        auto point = [&](int t, int x, int y, int z) __attribute__((always_inline)) {
+                const T *c = data.data + t * data.st + x * data.sx + y * data.sy + z * data.sz;
+                if (const uint32_t kind = check<K>(c, &offs[t * K], st[t]))
+                        ans.extrema.push_back(extremum_t { x, y, z, t, static_cast<float>(*c), kind });
+        };
+
+        // still in storage order
+        if (data.get_layout() == Layout::TIME_MAJOR) {
+                for (int t = 0; t < steps; t++)
+                        for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++)
+                                for (int x = lo[0]; x < hi[0]; x++)
+                                        point(t, x, y, z);
+        } else {
+                for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++)
+                        for (int x = lo[0]; x < hi[0]; x++) for (int t = 0; t < steps; t++)
+                                point(t, x, y, z);
+        }
+
+        for (int t = 0; t < steps; t++) {
+                ans.cnt_min[t] += st[t].cnt_min;
+                ans.cnt_max[t] += st[t].cnt_max;
+                ans.gmin[t] = st[t].lo;
+                ans.gmax[t] = st[t].hi;
+        }
+}
+
+// K neighbours, TIME if two of them are in time
+template<int K, bool TIME, typename T>
+static void sweep_tile(const Block<T> &data, Point lo, Point hi, int steps, int n,
+                row_kernel_t kernel, answer_t<T> &ans)
+{
+        if (ans.locate) {
+                locate_tile<K, TIME>(data, lo, hi, steps, n, ans);
+                return;
+        }
+
+        if (data.get_layout() == Layout::TIME_MAJOR) {
+                // unit-stride sweeps along x, one row of a timestep at a time.
+                // the SIMD kernels only come in float
+                for (int t = 0; t < steps; t++) {
+                        stats_t<T> st { 0, 0, ans.gmin[t], ans.gmax[t] };
+                        long off[K];
+                        neighbour_offsets(data, n, TIME, t, steps, off);
+
+                        for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++) {
+                                const T *row = data.data + t * data.st + lo[0] + y * data.sy
+                                        + z * data.sz;
+                                if constexpr (std::is_same_v<T, float>)
+                                        kernel(row, off, hi[0] - lo[0], st);
+                                else
+                                        for (int x = 0; x < hi[0] - lo[0]; x++)
+                                                check<K>(row + x, off, st);
+                        }
+
+                        ans.cnt_min[t] += st.cnt_min;
+                        ans.cnt_max[t] += st.cnt_max;
+                        ans.gmin[t] = st.lo;
+                        ans.gmax[t] = st.hi;
+                }
+                return;
+        }
+
+        // the timesteps of a point are next to each other, so they go innermost
+        // and the neighbours are a fixed offset away for all of them (but for
+        // the ones in time at either end). the stats are kept on the stack, ans
+        // is a vector the compiler can't keep in registers (as far as it knows
+        // it could alias data)
+        std::vector<long> offs((TIME ? steps : 1) * K);
+        for (int t = 0; t < (TIME ? steps : 1); t++)
+                neighbour_offsets(data, n, TIME, t, steps, &offs[t * K]);
+        std::vector<stats_t<T>> st(steps);
+        for (int t = 0; t < steps; t++) st[t] = stats_t<T> { 0, 0, ans.gmin[t], ans.gmax[t] };
+
+        for (int z = lo[2]; z < hi[2]; z++) for (int y = lo[1]; y < hi[1]; y++) {
+                const T *row = data.data + lo[0] * data.sx + y * data.sy + z * data.sz;
+                for (int x = 0; x < hi[0] - lo[0]; x++) {
+                        const T *c = row + x * data.sx;
+                        for (int t = 0; t < steps; t++)
+                                check<K>(c + t, &offs[TIME ? t * K : 0], st[t]);
+                }
+        }
+
+        for (int t = 0; t < steps; t++) {
+                ans.cnt_min[t] += st[t].cnt_min;
+                ans.cnt_max[t] += st[t].cnt_max;
+                ans.gmin[t] = st[t].lo;
+                ans.gmax[t] = st[t].hi;
+        }
+}
+
+template<typename T>
+void sweep_tile(const Block<T> &data, Point lo, Point hi, int steps, int n,
+                bool temporal, row_kernel_t kernel, answer_t<T> &ans)
+{
+        auto sweep = temporal
+                ? (n == 27 ? sweep_tile<28, true, T> : n == 19 ? sweep_tile<20, true, T>
+                                : sweep_tile<8, true, T>)
+                : (n == 27 ? sweep_tile<26, false, T> : n == 19 ? sweep_tile<18, false, T>
+                                : sweep_tile<6, false, T>);
+        sweep(data, lo, hi, steps, n, kernel, ans);
+}
+
+template void sweep_tile<float>(const Block<float>&, Point, Point, int, int, bool, row_kernel_t,
+                answer_t<float>&);
+template void sweep_tile<double>(const Block<double>&, Point, Point, int, int, bool, row_kernel_t,
+                answer_t<double>&);